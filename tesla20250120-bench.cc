@@ -0,0 +1,667 @@
+// Side-by-side benchmark of the cache implementations in this directory.
+//
+// Every implementation is compiled into this binary in its own namespace,
+// with its main() renamed, and driven through a small adapter. Each
+// workload's operation trace is generated once from a fixed seed and
+// replayed unchanged against every implementation, so runs are
+// reproducible and the numbers are comparable.
+//
+// Output is one JSON object per (implementation, workload) line, with Get
+// latency split into hits and misses.
+//
+// gem2exp and interviewing still index their keys with std::unordered_map,
+// as the homework cache did before its flat Swiss-table style index, so
+// their get_hit and bytes_per_capacity_entry next to homework's are the
+// before/after numbers for that index. The caches differ in more than the
+// index, so this brackets its effect rather than isolating it. Memory
+// numbers from before MappedBytes() was added undercount homework: its
+// index is mmapped, not allocated with operator new.
+//
+// Options (all optional, --name=value):
+//   --impl=homework,homework-clock,homework-tinylfu,gem2exp,interviewing
+//                         implementations to run; homework-clock and
+//                         homework-tinylfu are the homework cache with
+//                         Recency::Clock and with Admission::TinyLFU
+//   --workload=zipf,scrambled,hotspot,scan
+//   --keys=100000 --capacity=10000 --ops=300000 --seed=1
+//   --read=0.9            fraction of operations that are Gets
+//   --fill=1              a Get miss is followed by a Set of the same key
+//   --theta=0.99          Zipf skew
+//   --ops-per-sec=1000    operations per simulated second
+//   --ttl=uniform:600     fixed:N | uniform:N | exp:MEAN (seconds)
+//   --priority=uniform:20 uniform:N | zipf:N (low priorities most common)
+
+// Everything the included files use must be included here first, at
+// global scope; their own #includes are then no-ops inside the namespaces.
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <list>
+#include <malloc.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <queue>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define main homework_main
+namespace homework
+{
+#include "tesla20250120-homework.cc"
+}
+#undef main
+
+#define main gem2exp_main
+namespace gem2exp
+{
+#include "tesla20250120-homework-gem2exp.cc"
+}
+#undef main
+
+#define main interviewing_main
+namespace interviewing
+{
+#include "tesla20250120-interviewing.cc"
+}
+#undef main
+
+using homework::LatencyHistogram;
+
+// Live heap bytes, counted by replacing the global operator new/delete.
+// malloc_usable_size is what the allocator really handed out. Memory an
+// implementation maps itself is added from its adapter's MappedBytes().
+static size_t g_LiveBytes = 0;
+
+void *operator new(size_t size)
+{
+  void *p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr)
+  {
+    throw std::bad_alloc();
+  }
+  g_LiveBytes += malloc_usable_size(p);
+  return p;
+}
+
+void operator delete(void *p) noexcept
+{
+  if (p != nullptr)
+  {
+    g_LiveBytes -= malloc_usable_size(p);
+    free(p);
+  }
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  operator delete(p);
+}
+
+// Adapters: a name, a constructor taking the capacity, Get returning
+// whether the key was a live hit, Set, bytes held outside operator new,
+// and the simulated clock
+struct HomeworkAdapter
+{
+  static const char *Name()
+  {
+    return "homework";
+  }
+
+  homework::PriorityExpiryCache cache;
+
+  explicit HomeworkAdapter(int capacity, const homework::CacheOptions &options = homework::CacheOptions())
+      : cache(capacity, options) {}
+
+  bool Get(const std::string &key)
+  {
+    return cache.Get(key) != nullptr;
+  }
+
+  void Set(const std::string &key, int value, int priority, int ttl)
+  {
+    cache.Set(key, value, priority, ttl);
+  }
+
+  size_t MappedBytes() const
+  {
+    return cache.MappedBytes();
+  }
+
+  static void SetTime(int now)
+  {
+    homework::g_Time = now;
+  }
+};
+
+// Same cache with CLOCK recency, to compare its hit ratio with exact LRU
+struct HomeworkClockAdapter : HomeworkAdapter
+{
+  static const char *Name()
+  {
+    return "homework-clock";
+  }
+
+  static homework::CacheOptions Options()
+  {
+    homework::CacheOptions options;
+    options.recency = homework::Recency::Clock;
+    return options;
+  }
+
+  explicit HomeworkClockAdapter(int capacity) : HomeworkAdapter(capacity, Options()) {}
+};
+
+// Same cache with the TinyLFU admission filter, for the scan workload
+struct HomeworkTinyLfuAdapter : HomeworkAdapter
+{
+  static const char *Name()
+  {
+    return "homework-tinylfu";
+  }
+
+  static homework::CacheOptions Options()
+  {
+    homework::CacheOptions options;
+    options.admission = homework::Admission::TinyLFU;
+    return options;
+  }
+
+  explicit HomeworkTinyLfuAdapter(int capacity) : HomeworkAdapter(capacity, Options()) {}
+};
+
+struct Gem2expAdapter
+{
+  static const char *Name()
+  {
+    return "gem2exp";
+  }
+
+  gem2exp::PriorityExpiryCache cache;
+
+  explicit Gem2expAdapter(int capacity) : cache(capacity) {}
+
+  bool Get(const std::string &key)
+  {
+    return cache.Get(key) != nullptr;
+  }
+
+  void Set(const std::string &key, int value, int priority, int ttl)
+  {
+    cache.Set(key, value, priority, ttl);
+  }
+
+  size_t MappedBytes() const
+  {
+    return 0;
+  }
+
+  static void SetTime(int now)
+  {
+    gem2exp::g_Time = now;
+  }
+};
+
+struct InterviewingAdapter
+{
+  static const char *Name()
+  {
+    return "interviewing";
+  }
+
+  interviewing::PriorityExpiryCache cache;
+
+  explicit InterviewingAdapter(int capacity) : cache(capacity) {}
+
+  bool Get(const std::string &key)
+  {
+    return cache.Get(key) != nullptr;
+  }
+
+  void Set(const std::string &key, int value, int priority, int ttl)
+  {
+    cache.Set(key, value, priority, ttl);
+  }
+
+  size_t MappedBytes() const
+  {
+    return 0;
+  }
+
+  static void SetTime(int now)
+  {
+    interviewing::g_Time = now;
+  }
+};
+
+struct BenchConfig
+{
+  std::vector<std::string> impls = {"homework", "homework-clock", "homework-tinylfu", "gem2exp", "interviewing"};
+  std::vector<std::string> workloads = {"zipf", "scrambled", "hotspot", "scan"};
+  int keys = 100000;
+  int capacity = 10000;
+  int ops = 300000;
+  uint64_t seed = 1;
+  double readRatio = 0.9;
+  bool fillOnMiss = true;
+  double theta = 0.99;
+  int opsPerSecond = 1000;
+  std::string ttl = "uniform:600";
+  std::string priority = "uniform:20";
+};
+
+// Zipfian ranks in [0, n), rank 0 the most popular (Gray et al., as in YCSB)
+class ZipfGenerator
+{
+  private:
+  uint64_t n;
+  double theta, alpha, zetan, eta;
+
+  public:
+  ZipfGenerator(uint64_t n, double theta) : n(n), theta(theta)
+  {
+    zetan = 0;
+    for (uint64_t i = 1; i <= n; ++i)
+    {
+      zetan += 1.0 / std::pow(static_cast<double>(i), theta);
+    }
+    double zeta2 = 1.0 + 1.0 / std::pow(2.0, theta);
+    alpha = 1.0 / (1.0 - theta);
+    eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+  }
+
+  template <typename Rng>
+  uint64_t Next(Rng &rng)
+  {
+    double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    double uz = u * zetan;
+    if (uz < 1.0)
+    {
+      return 0;
+    }
+    if (uz < 1.0 + std::pow(0.5, theta))
+    {
+      return 1;
+    }
+    return std::min<uint64_t>(n - 1, static_cast<uint64_t>(n * std::pow(eta * u - eta + 1.0, alpha)));
+  }
+};
+
+// One recorded operation; a Get that misses may turn into a fill
+struct TraceOp
+{
+  uint32_t key;
+  bool isGet;
+  int priority;
+  int ttl;
+};
+
+// "kind:number" option values
+static std::pair<std::string, double> ParseDistribution(const std::string &spec)
+{
+  size_t colon = spec.find(':');
+  if (colon == std::string::npos)
+  {
+    return {spec, 0};
+  }
+  return {spec.substr(0, colon), std::stod(spec.substr(colon + 1))};
+}
+
+static uint64_t Scramble(uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  return x;
+}
+
+// Build the operation trace for one workload:
+//   zipf      popular keys are the low key ids
+//   scrambled same popularity, hot keys spread over the id space
+//   hotspot   Zipf whose hot set jumps to other keys ten times per run
+//   scan      Zipf reads interleaved with long sequential scans (1/5 of ops)
+static std::vector<TraceOp> BuildTrace(const BenchConfig &config, const std::string &workload)
+{
+  std::mt19937_64 rng(config.seed);
+  ZipfGenerator zipf(config.keys, config.theta);
+  auto ttl = ParseDistribution(config.ttl);
+  auto priority = ParseDistribution(config.priority);
+  int numPriorities = std::max(1, static_cast<int>(priority.second));
+  ZipfGenerator priorityZipf(numPriorities, config.theta);
+  std::bernoulli_distribution isGet(config.readRatio);
+
+  const int scanLength = 1000;
+  int scanLeft = 0;
+  uint32_t scanCursor = 0;
+
+  std::vector<TraceOp> trace(config.ops);
+  for (int i = 0; i < config.ops; ++i)
+  {
+    TraceOp &op = trace[i];
+    uint64_t rank = zipf.Next(rng);
+    if (workload == "scrambled")
+    {
+      op.key = Scramble(rank) % config.keys;
+    }
+    else if (workload == "hotspot")
+    {
+      uint64_t shift = static_cast<uint64_t>(i) / std::max(1, config.ops / 10) * (config.keys / 10 + 7);
+      op.key = (Scramble(rank) + shift) % config.keys;
+    }
+    else if (workload == "scan")
+    {
+      if (scanLeft == 0 && rng() % (4 * scanLength) == 0)
+      {
+        scanLeft = scanLength;
+        scanCursor = rng() % config.keys;
+      }
+      if (scanLeft > 0)
+      {
+        --scanLeft;
+        rank = scanCursor++ % config.keys;
+      }
+      op.key = rank;
+    }
+    else
+    {
+      op.key = rank;
+    }
+    op.isGet = isGet(rng);
+
+    if (ttl.first == "fixed")
+    {
+      op.ttl = static_cast<int>(ttl.second);
+    }
+    else if (ttl.first == "exp")
+    {
+      op.ttl = static_cast<int>(std::exponential_distribution<double>(1.0 / ttl.second)(rng));
+    }
+    else
+    {
+      op.ttl = static_cast<int>(rng() % std::max<uint64_t>(1, static_cast<uint64_t>(ttl.second)));
+    }
+
+    op.priority = priority.first == "zipf" ? static_cast<int>(priorityZipf.Next(rng)) : static_cast<int>(rng() % numPriorities);
+  }
+  return trace;
+}
+
+static void PrintLatency(const char *name, const LatencyHistogram &h)
+{
+  std::cout << "\"" << name << "\":{\"count\":" << h.Count() << ",\"p50\":" << h.Percentile(0.5)
+            << ",\"p99\":" << h.Percentile(0.99) << ",\"p999\":" << h.Percentile(0.999) << ",\"max\":" << h.Max()
+            << "}";
+}
+
+static uint64_t NowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Replay the trace against one implementation and print its JSON line
+template <typename Adapter>
+void RunOne(const BenchConfig &config, const std::string &workload, const std::vector<TraceOp> &trace,
+            const std::vector<std::string> &keyNames)
+{
+  Adapter::SetTime(0);
+  size_t bytesBefore = g_LiveBytes;
+  size_t peakBytes = 0;
+  LatencyHistogram getHitLatency, getMissLatency, setLatency;
+  uint64_t hits = 0, gets = 0;
+
+  {
+    Adapter cache(config.capacity);
+    uint64_t start = NowNs();
+    for (size_t i = 0; i < trace.size(); ++i)
+    {
+      const TraceOp &op = trace[i];
+      if (i % config.opsPerSecond == 0)
+      {
+        Adapter::SetTime(static_cast<int>(i / config.opsPerSecond));
+      }
+      const std::string &key = keyNames[op.key];
+      bool write = !op.isGet;
+      if (op.isGet)
+      {
+        uint64_t t0 = NowNs();
+        bool hit = cache.Get(key);
+        (hit ? getHitLatency : getMissLatency).Record(NowNs() - t0);
+        ++gets;
+        hits += hit;
+        write = !hit && config.fillOnMiss;
+      }
+      if (write)
+      {
+        uint64_t t0 = NowNs();
+        cache.Set(key, static_cast<int>(i), op.priority, op.ttl);
+        setLatency.Record(NowNs() - t0);
+      }
+      if ((i & 1023) == 0)
+      {
+        peakBytes = std::max(peakBytes, g_LiveBytes - bytesBefore + cache.MappedBytes());
+      }
+    }
+    double seconds = (NowNs() - start) / 1e9;
+    size_t finalBytes = g_LiveBytes - bytesBefore + cache.MappedBytes();
+    peakBytes = std::max(peakBytes, finalBytes);
+
+    std::cout << "{\"impl\":\"" << Adapter::Name() << "\",\"workload\":\"" << workload << "\",\"keys\":" << config.keys
+              << ",\"capacity\":" << config.capacity << ",\"ops\":" << trace.size() << ",\"read\":" << config.readRatio
+              << ",\"ttl\":\"" << config.ttl << "\",\"priority\":\"" << config.priority << "\",\"seconds\":" << seconds
+              << ",\"ops_per_sec\":" << static_cast<uint64_t>(trace.size() / seconds)
+              << ",\"hit_ratio\":" << (gets ? static_cast<double>(hits) / gets : 0.0)
+              << ",\"bytes\":" << finalBytes << ",\"peak_bytes\":" << peakBytes
+              << ",\"bytes_per_capacity_entry\":" << finalBytes / std::max(1, config.capacity) << ",\"latency_ns\":{";
+    PrintLatency("get_hit", getHitLatency);
+    std::cout << ",";
+    PrintLatency("get_miss", getMissLatency);
+    std::cout << ",";
+    PrintLatency("set", setLatency);
+    std::cout << "}}" << std::endl;
+  }
+}
+
+static std::vector<std::string> SplitList(const std::string &list)
+{
+  std::vector<std::string> items;
+  size_t begin = 0;
+  while (begin <= list.size())
+  {
+    size_t end = std::min(list.find(',', begin), list.size());
+    if (end > begin)
+    {
+      items.push_back(list.substr(begin, end - begin));
+    }
+    begin = end + 1;
+  }
+  return items;
+}
+
+static bool ParseArgs(int argc, char **argv, BenchConfig &config)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+    {
+      std::cerr << "Bad argument: " << arg << std::endl;
+      return false;
+    }
+    std::string name = arg.substr(2, eq - 2), value = arg.substr(eq + 1);
+    if (name == "impl")
+    {
+      config.impls = SplitList(value);
+    }
+    else if (name == "workload")
+    {
+      config.workloads = SplitList(value);
+    }
+    else if (name == "keys")
+    {
+      config.keys = std::stoi(value);
+    }
+    else if (name == "capacity")
+    {
+      config.capacity = std::stoi(value);
+    }
+    else if (name == "ops")
+    {
+      config.ops = std::stoi(value);
+    }
+    else if (name == "seed")
+    {
+      config.seed = std::stoull(value);
+    }
+    else if (name == "read")
+    {
+      config.readRatio = std::stod(value);
+    }
+    else if (name == "fill")
+    {
+      config.fillOnMiss = std::stoi(value) != 0;
+    }
+    else if (name == "theta")
+    {
+      config.theta = std::stod(value);
+    }
+    else if (name == "ops-per-sec")
+    {
+      config.opsPerSecond = std::max(1, std::stoi(value));
+    }
+    else if (name == "ttl")
+    {
+      config.ttl = value;
+    }
+    else if (name == "priority")
+    {
+      config.priority = value;
+    }
+    else
+    {
+      std::cerr << "Unknown option: " << name << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  BenchConfig config;
+  if (!ParseArgs(argc, argv, config))
+  {
+    return 1;
+  }
+
+  std::vector<std::string> keyNames;
+  for (int i = 0; i < config.keys; ++i)
+  {
+    keyNames.push_back("user" + std::to_string(i));
+  }
+
+  for (const std::string &workload : config.workloads)
+  {
+    std::vector<TraceOp> trace = BuildTrace(config, workload);
+    for (const std::string &impl : config.impls)
+    {
+      if (impl == HomeworkAdapter::Name())
+      {
+        RunOne<HomeworkAdapter>(config, workload, trace, keyNames);
+      }
+      else if (impl == HomeworkClockAdapter::Name())
+      {
+        RunOne<HomeworkClockAdapter>(config, workload, trace, keyNames);
+      }
+      else if (impl == HomeworkTinyLfuAdapter::Name())
+      {
+        RunOne<HomeworkTinyLfuAdapter>(config, workload, trace, keyNames);
+      }
+      else if (impl == Gem2expAdapter::Name())
+      {
+        RunOne<Gem2expAdapter>(config, workload, trace, keyNames);
+      }
+      else if (impl == InterviewingAdapter::Name())
+      {
+        RunOne<InterviewingAdapter>(config, workload, trace, keyNames);
+      }
+      else
+      {
+        std::cerr << "Unknown implementation: " << impl << std::endl;
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+// g++ -std=c++17 -O2 -pthread tesla20250120-bench.cc -o bench && ./bench
+
+// {"impl":"homework","workload":"zipf","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.138089,"ops_per_sec":2172511,"hit_ratio":0.601945,"bytes":1672216,"peak_bytes":1803808,"bytes_per_capacity_entry":167,"latency_ns":{"get_hit":{"count":162486,"p50":127,"p99":575,"p999":863,"max":1682565},"get_miss":{"count":107449,"p50":239,"p99":671,"p999":991,"max":271797},"set":{"count":137514,"p50":303,"p99":1023,"p999":14847,"max":976878}}}
+// {"impl":"homework-clock","workload":"zipf","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.149153,"ops_per_sec":2011350,"hit_ratio":0.602671,"bytes":1672216,"peak_bytes":1803808,"bytes_per_capacity_entry":167,"latency_ns":{"get_hit":{"count":162682,"p50":111,"p99":575,"p999":895,"max":156158},"get_miss":{"count":107253,"p50":231,"p99":639,"p999":895,"max":7862663},"set":{"count":137318,"p50":319,"p99":1023,"p999":15871,"max":857502}}}
+// {"impl":"homework-tinylfu","workload":"zipf","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.144181,"ops_per_sec":2080720,"hit_ratio":0.602301,"bytes":1704992,"peak_bytes":1836544,"bytes_per_capacity_entry":170,"latency_ns":{"get_hit":{"count":162582,"p50":159,"p99":543,"p999":831,"max":663384},"get_miss":{"count":107353,"p50":239,"p99":607,"p999":831,"max":255475},"set":{"count":137418,"p50":383,"p99":927,"p999":11775,"max":390400}}}
+// {"impl":"gem2exp","workload":"zipf","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.250598,"ops_per_sec":1197134,"hit_ratio":0.60196,"bytes":2562544,"peak_bytes":2563640,"bytes_per_capacity_entry":256,"latency_ns":{"get_hit":{"count":162490,"p50":183,"p99":959,"p999":1407,"max":418022},"get_miss":{"count":107445,"p50":383,"p99":1151,"p999":1663,"max":439809},"set":{"count":137510,"p50":799,"p99":2175,"p999":6399,"max":6218439}}}
+// {"impl":"interviewing","workload":"zipf","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.175061,"ops_per_sec":1713688,"hit_ratio":0.601945,"bytes":1953208,"peak_bytes":1953224,"bytes_per_capacity_entry":195,"latency_ns":{"get_hit":{"count":162486,"p50":127,"p99":671,"p999":991,"max":854884},"get_miss":{"count":107449,"p50":351,"p99":895,"p999":1343,"max":839111},"set":{"count":137514,"p50":415,"p99":1791,"p999":13823,"max":3225743}}}
+// {"impl":"homework","workload":"scrambled","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.19062,"ops_per_sec":1573814,"hit_ratio":0.641195,"bytes":1672216,"peak_bytes":1803808,"bytes_per_capacity_entry":167,"latency_ns":{"get_hit":{"count":173081,"p50":119,"p99":607,"p999":1087,"max":10076133},"get_miss":{"count":96854,"p50":215,"p99":607,"p999":1087,"max":509375},"set":{"count":126919,"p50":303,"p99":959,"p999":13823,"max":12940369}}}
+// {"impl":"homework-clock","workload":"scrambled","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.165742,"ops_per_sec":1810047,"hit_ratio":0.641851,"bytes":1672232,"peak_bytes":1803824,"bytes_per_capacity_entry":167,"latency_ns":{"get_hit":{"count":173258,"p50":103,"p99":607,"p999":927,"max":1794522},"get_miss":{"count":96677,"p50":223,"p99":639,"p999":959,"max":8596652},"set":{"count":126742,"p50":303,"p99":991,"p999":13823,"max":2976217}}}
+// {"impl":"homework-tinylfu","workload":"scrambled","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.204406,"ops_per_sec":1467669,"hit_ratio":0.641366,"bytes":1704992,"peak_bytes":1836584,"bytes_per_capacity_entry":170,"latency_ns":{"get_hit":{"count":173127,"p50":151,"p99":735,"p999":1599,"max":2383898},"get_miss":{"count":96808,"p50":271,"p99":703,"p999":3839,"max":13010340},"set":{"count":126873,"p50":351,"p99":1151,"p999":23551,"max":7058876}}}
+// {"impl":"gem2exp","workload":"scrambled","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.376369,"ops_per_sec":797089,"hit_ratio":0.641032,"bytes":2562560,"peak_bytes":2563784,"bytes_per_capacity_entry":256,"latency_ns":{"get_hit":{"count":173037,"p50":215,"p99":1215,"p999":2303,"max":4452240},"get_miss":{"count":96898,"p50":415,"p99":1279,"p999":6911,"max":9538810},"set":{"count":126963,"p50":863,"p99":2431,"p999":30719,"max":10875572}}}
+// {"impl":"interviewing","workload":"scrambled","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.170366,"ops_per_sec":1760913,"hit_ratio":0.641195,"bytes":1953208,"peak_bytes":1953240,"bytes_per_capacity_entry":195,"latency_ns":{"get_hit":{"count":173081,"p50":143,"p99":703,"p999":1151,"max":98227},"get_miss":{"count":96854,"p50":319,"p99":799,"p999":1471,"max":204333},"set":{"count":126919,"p50":447,"p99":1983,"p999":13823,"max":528221}}}
+// {"impl":"homework","workload":"hotspot","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.146925,"ops_per_sec":2041857,"hit_ratio":0.49599,"bytes":1672192,"peak_bytes":1803784,"bytes_per_capacity_entry":167,"latency_ns":{"get_hit":{"count":133885,"p50":127,"p99":607,"p999":1087,"max":1291995},"get_miss":{"count":136050,"p50":247,"p99":639,"p999":1023,"max":124505},"set":{"count":166115,"p50":303,"p99":959,"p999":13823,"max":406147}}}
+// {"impl":"homework-clock","workload":"hotspot","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.246556,"ops_per_sec":1216760,"hit_ratio":0.495786,"bytes":1672176,"peak_bytes":1803784,"bytes_per_capacity_entry":167,"latency_ns":{"get_hit":{"count":133830,"p50":111,"p99":767,"p999":1215,"max":621536},"get_miss":{"count":136105,"p50":287,"p99":703,"p999":1343,"max":6974307},"set":{"count":166170,"p50":303,"p99":1279,"p999":20479,"max":11680106}}}
+// {"impl":"homework-tinylfu","workload":"hotspot","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.227815,"ops_per_sec":1316859,"hit_ratio":0.495338,"bytes":1704968,"peak_bytes":1836560,"bytes_per_capacity_entry":170,"latency_ns":{"get_hit":{"count":133709,"p50":159,"p99":735,"p999":1279,"max":10114440},"get_miss":{"count":136226,"p50":271,"p99":703,"p999":1215,"max":8184474},"set":{"count":166291,"p50":335,"p99":1215,"p999":17407,"max":10479038}}}
+// {"impl":"gem2exp","workload":"hotspot","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.302244,"ops_per_sec":992574,"hit_ratio":0.495953,"bytes":2562400,"peak_bytes":2563752,"bytes_per_capacity_entry":256,"latency_ns":{"get_hit":{"count":133875,"p50":175,"p99":1023,"p999":1535,"max":10980968},"get_miss":{"count":136060,"p50":367,"p99":1151,"p999":1663,"max":14387115},"set":{"count":166125,"p50":671,"p99":1855,"p999":3199,"max":7177703}}}
+// {"impl":"interviewing","workload":"hotspot","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.275468,"ops_per_sec":1089056,"hit_ratio":0.49599,"bytes":1953208,"peak_bytes":1953288,"bytes_per_capacity_entry":195,"latency_ns":{"get_hit":{"count":133885,"p50":127,"p99":767,"p999":1279,"max":4925394},"get_miss":{"count":136050,"p50":319,"p99":1087,"p999":1791,"max":15662712},"set":{"count":166115,"p50":415,"p99":1791,"p999":13823,"max":4276797}}}
+// {"impl":"homework","workload":"scan","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.14066,"ops_per_sec":2132802,"hit_ratio":0.462348,"bytes":1672264,"peak_bytes":1738280,"bytes_per_capacity_entry":167,"latency_ns":{"get_hit":{"count":124890,"p50":135,"p99":543,"p999":895,"max":594907},"get_miss":{"count":145231,"p50":135,"p99":607,"p999":831,"max":109452},"set":{"count":175110,"p50":303,"p99":863,"p999":13311,"max":462790}}}
+// {"impl":"homework-clock","workload":"scan","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.138995,"ops_per_sec":2158357,"hit_ratio":0.463333,"bytes":1672248,"peak_bytes":1738264,"bytes_per_capacity_entry":167,"latency_ns":{"get_hit":{"count":125156,"p50":119,"p99":575,"p999":895,"max":590630},"get_miss":{"count":144965,"p50":135,"p99":607,"p999":895,"max":89266},"set":{"count":174844,"p50":303,"p99":927,"p999":13823,"max":258743}}}
+// {"impl":"homework-tinylfu","workload":"scan","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.163255,"ops_per_sec":1837610,"hit_ratio":0.463018,"bytes":1705024,"peak_bytes":1771040,"bytes_per_capacity_entry":170,"latency_ns":{"get_hit":{"count":125071,"p50":159,"p99":639,"p999":927,"max":1186169},"get_miss":{"count":145050,"p50":175,"p99":639,"p999":1023,"max":248794},"set":{"count":174929,"p50":351,"p99":959,"p999":15359,"max":1678343}}}
+// {"impl":"gem2exp","workload":"scan","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.360626,"ops_per_sec":831886,"hit_ratio":0.462408,"bytes":2562488,"peak_bytes":2563752,"bytes_per_capacity_entry":256,"latency_ns":{"get_hit":{"count":124906,"p50":191,"p99":1087,"p999":1535,"max":1380160},"get_miss":{"count":145215,"p50":335,"p99":1151,"p999":1791,"max":9517322},"set":{"count":175094,"p50":767,"p99":2047,"p999":21503,"max":8423642}}}
+// {"impl":"interviewing","workload":"scan","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.28419,"ops_per_sec":1055630,"hit_ratio":0.462348,"bytes":1953064,"peak_bytes":1953208,"bytes_per_capacity_entry":195,"latency_ns":{"get_hit":{"count":124890,"p50":143,"p99":735,"p999":1215,"max":3487690},"get_miss":{"count":145231,"p50":287,"p99":927,"p999":1407,"max":11785186},"set":{"count":175110,"p50":463,"p99":1855,"p999":15359,"max":10119774}}}
+
+// ./bench --impl=homework,homework-tinylfu --priority=uniform:1
+
+// {"impl":"homework","workload":"zipf","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:1","seconds":0.111493,"ops_per_sec":2690740,"hit_ratio":0.721333,"bytes":1671208,"peak_bytes":1736744,"bytes_per_capacity_entry":167,"latency_ns":{"get_hit":{"count":194713,"p50":127,"p99":415,"p999":671,"max":119001},"get_miss":{"count":75222,"p50":271,"p99":639,"p999":1087,"max":84525},"set":{"count":105287,"p50":303,"p99":991,"p999":10751,"max":173295}}}
+// {"impl":"homework-tinylfu","workload":"zipf","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:1","seconds":0.111783,"ops_per_sec":2683778,"hit_ratio":0.737048,"bytes":1703984,"peak_bytes":1835056,"bytes_per_capacity_entry":170,"latency_ns":{"get_hit":{"count":198955,"p50":151,"p99":479,"p999":831,"max":135550},"get_miss":{"count":70980,"p50":303,"p99":639,"p999":1279,"max":79274},"set":{"count":101045,"p50":199,"p99":927,"p999":12287,"max":1123569}}}
+// {"impl":"homework","workload":"scrambled","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:1","seconds":0.135882,"ops_per_sec":2207796,"hit_ratio":0.751288,"bytes":1671208,"peak_bytes":1802280,"bytes_per_capacity_entry":167,"latency_ns":{"get_hit":{"count":202799,"p50":119,"p99":543,"p999":863,"max":10486243},"get_miss":{"count":67136,"p50":303,"p99":671,"p999":1151,"max":207647},"set":{"count":97201,"p50":319,"p99":991,"p999":11263,"max":259658}}}
+// {"impl":"homework-tinylfu","workload":"scrambled","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:1","seconds":0.157702,"ops_per_sec":1902318,"hit_ratio":0.768103,"bytes":1703984,"peak_bytes":1835056,"bytes_per_capacity_entry":170,"latency_ns":{"get_hit":{"count":207338,"p50":159,"p99":639,"p999":1023,"max":7561011},"get_miss":{"count":62597,"p50":335,"p99":703,"p999":1343,"max":3309176},"set":{"count":92662,"p50":215,"p99":1215,"p999":15359,"max":11209111}}}
+// {"impl":"homework","workload":"hotspot","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:1","seconds":0.17814,"ops_per_sec":1684069,"hit_ratio":0.68339,"bytes":1671208,"peak_bytes":1802280,"bytes_per_capacity_entry":167,"latency_ns":{"get_hit":{"count":184471,"p50":115,"p99":607,"p999":959,"max":4293663},"get_miss":{"count":85464,"p50":319,"p99":703,"p999":1343,"max":9517147},"set":{"count":115529,"p50":335,"p99":1087,"p999":11263,"max":10068502}}}
+// {"impl":"homework-tinylfu","workload":"hotspot","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:1","seconds":0.220716,"ops_per_sec":1359212,"hit_ratio":0.614455,"bytes":1703984,"peak_bytes":1835056,"bytes_per_capacity_entry":170,"latency_ns":{"get_hit":{"count":165863,"p50":151,"p99":703,"p999":1215,"max":4693582},"get_miss":{"count":104072,"p50":319,"p99":703,"p999":1087,"max":11933345},"set":{"count":134137,"p50":199,"p99":1215,"p999":16383,"max":11735956}}}
+// {"impl":"homework","workload":"scan","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:1","seconds":0.135984,"ops_per_sec":2206142,"hit_ratio":0.572406,"bytes":1671208,"peak_bytes":1867816,"bytes_per_capacity_entry":167,"latency_ns":{"get_hit":{"count":154619,"p50":135,"p99":495,"p999":767,"max":2769852},"get_miss":{"count":115502,"p50":191,"p99":639,"p999":1407,"max":424689},"set":{"count":145381,"p50":319,"p99":991,"p999":11775,"max":225181}}}
+// {"impl":"homework-tinylfu","workload":"scan","keys":100000,"capacity":10000,"ops":300000,"read":0.9,"ttl":"uniform:600","priority":"uniform:1","seconds":0.121928,"ops_per_sec":2460464,"hit_ratio":0.593856,"bytes":1703984,"peak_bytes":1835056,"bytes_per_capacity_entry":170,"latency_ns":{"get_hit":{"count":160413,"p50":159,"p99":511,"p999":767,"max":85769},"get_miss":{"count":109708,"p50":199,"p99":639,"p999":1023,"max":731956},"set":{"count":139587,"p50":183,"p99":927,"p999":13311,"max":84499}}}
+
+// ./bench --impl=homework,gem2exp,interviewing --workload=zipf,scrambled --keys=1000000 --capacity=100000 --ops=1000000
+
+// {"impl":"homework","workload":"zipf","keys":1000000,"capacity":100000,"ops":1000000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":1.02026,"ops_per_sec":980146,"hit_ratio":0.712546,"bytes":12485320,"peak_bytes":12845872,"bytes_per_capacity_entry":124,"latency_ns":{"get_hit":{"count":641370,"p50":223,"p99":1087,"p999":1727,"max":1266707},"get_miss":{"count":258740,"p50":543,"p99":1151,"p999":1983,"max":3596647},"set":{"count":358630,"p50":271,"p99":2943,"p999":507903,"max":2599140}}}
+// {"impl":"gem2exp","workload":"zipf","keys":1000000,"capacity":100000,"ops":1000000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":1.85044,"ops_per_sec":540412,"hit_ratio":0.712241,"bytes":26184904,"peak_bytes":26184936,"bytes_per_capacity_entry":261,"latency_ns":{"get_hit":{"count":641095,"p50":479,"p99":1855,"p999":2687,"max":12141502},"get_miss":{"count":259015,"p50":863,"p99":2815,"p999":4607,"max":3047323},"set":{"count":358905,"p50":2175,"p99":5887,"p999":23551,"max":15306853}}}
+// {"impl":"interviewing","workload":"zipf","keys":1000000,"capacity":100000,"ops":1000000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":1.06275,"ops_per_sec":940956,"hit_ratio":0.712546,"bytes":16599624,"peak_bytes":16670296,"bytes_per_capacity_entry":165,"latency_ns":{"get_hit":{"count":641370,"p50":335,"p99":1471,"p999":2175,"max":1348968},"get_miss":{"count":258740,"p50":735,"p99":1855,"p999":2687,"max":2258691},"set":{"count":358630,"p50":319,"p99":1983,"p999":360447,"max":10426299}}}
+// {"impl":"homework","workload":"scrambled","keys":1000000,"capacity":100000,"ops":1000000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":0.855128,"ops_per_sec":1169416,"hit_ratio":0.728445,"bytes":11928384,"peak_bytes":12682096,"bytes_per_capacity_entry":119,"latency_ns":{"get_hit":{"count":655681,"p50":223,"p99":1087,"p999":1663,"max":692196},"get_miss":{"count":244429,"p50":495,"p99":991,"p999":1791,"max":963047},"set":{"count":344319,"p50":223,"p99":1791,"p999":360447,"max":1213500}}}
+// {"impl":"gem2exp","workload":"scrambled","keys":1000000,"capacity":100000,"ops":1000000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":1.34625,"ops_per_sec":742805,"hit_ratio":0.728118,"bytes":26184904,"peak_bytes":26184968,"bytes_per_capacity_entry":261,"latency_ns":{"get_hit":{"count":655386,"p50":399,"p99":1663,"p999":2303,"max":438300},"get_miss":{"count":244724,"p50":767,"p99":2687,"p999":3711,"max":4896188},"set":{"count":344614,"p50":1727,"p99":4095,"p999":7167,"max":14196824}}}
+// {"impl":"interviewing","workload":"scrambled","keys":1000000,"capacity":100000,"ops":1000000,"read":0.9,"ttl":"uniform:600","priority":"uniform:20","seconds":1.13302,"ops_per_sec":882598,"hit_ratio":0.728445,"bytes":15622296,"peak_bytes":15693848,"bytes_per_capacity_entry":156,"latency_ns":{"get_hit":{"count":655681,"p50":399,"p99":1535,"p999":2175,"max":4322649},"get_miss":{"count":244429,"p50":735,"p99":1663,"p999":2431,"max":10501656},"set":{"count":344319,"p50":319,"p99":1983,"p999":327679,"max":12521338}}}
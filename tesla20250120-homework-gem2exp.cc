@@ -47,9 +47,11 @@ e10 => expires at 10 seconds since epoch
 #include <thread>
 #include <unordered_map>
 #include <list>
+#include <map>
 #include <algorithm>
 #include <limits>
 #include <climits>
+#include <vector>
 
 int g_Time = 0;
 
@@ -60,14 +62,20 @@ struct CacheEntry {
     CacheData value;
     int priority;
     int expiryTime;
-    std::list<std::string>::iterator list_iterator;
+    long lastUsed; // Recency stamp, only for DebugPrintKeys
+    std::list<std::string>::iterator list_iterator;            // In lru_lists[priority]
+    std::multimap<int, std::string>::iterator expiry_iterator; // In expiry_index
 };
 
 struct PriorityExpiryCache {
   int maxItems;
-  // TODO(interviewee): implement this
   std::unordered_map<std::string, CacheEntry> cache;
-  std::list<std::string> lru_list;
+  // One LRU list per priority, most recently used at the front. The map is
+  // ordered, so begin() is always the lowest priority with any entries.
+  std::map<int, std::list<std::string>> lru_lists;
+  // Keys ordered by expiry time, earliest first
+  std::multimap<int, std::string> expiry_index;
+  long useCounter = 0;
 
 
   PriorityExpiryCache(int max_items) : maxItems(max_items) {}
@@ -80,15 +88,12 @@ struct PriorityExpiryCache {
     
     if (it->second.expiryTime <= g_Time) {
         // expired
-        lru_list.erase(it->second.list_iterator);
-        cache.erase(it);
+        Remove(it);
         return nullptr;
     }
     
-    // Move to the front of the LRU list
-    lru_list.erase(it->second.list_iterator);
-    lru_list.push_front(key);
-    it->second.list_iterator = lru_list.begin();
+    // Move to the front of the LRU list of its priority
+    Touch(it->second);
     
     return &it->second.value;
   }
@@ -98,24 +103,33 @@ struct PriorityExpiryCache {
     auto it = cache.find(key);
     if (it != cache.end()) {
         // update existing entry
-        it->second.value = value;
-        it->second.priority = priority;
-        it->second.expiryTime = g_Time + expiryInSecs;
-        
-        // Move to the front of the LRU list
-        lru_list.erase(it->second.list_iterator);
-        lru_list.push_front(key);
-        it->second.list_iterator = lru_list.begin();
+        CacheEntry& entry = it->second;
+        entry.value = value;
+        if (entry.priority != priority) {
+            Unlink(entry);
+            entry.priority = priority;
+            std::list<std::string>& lru_list = lru_lists[priority];
+            lru_list.push_front(key);
+            entry.list_iterator = lru_list.begin();
+            entry.lastUsed = ++useCounter;
+        } else {
+            Touch(entry);
+        }
+        entry.expiryTime = g_Time + expiryInSecs;
+        expiry_index.erase(entry.expiry_iterator);
+        entry.expiry_iterator = expiry_index.emplace(entry.expiryTime, key);
     } else {
         // insert new entry
-        CacheEntry entry;
+        CacheEntry& entry = cache[key];
         entry.key = key;
         entry.value = value;
         entry.priority = priority;
         entry.expiryTime = g_Time + expiryInSecs;
+        entry.lastUsed = ++useCounter;
+        std::list<std::string>& lru_list = lru_lists[priority];
         lru_list.push_front(key);
         entry.list_iterator = lru_list.begin();
-        cache[key] = entry;
+        entry.expiry_iterator = expiry_index.emplace(entry.expiryTime, key);
     }
     
     EvictItems();
@@ -127,53 +141,81 @@ struct PriorityExpiryCache {
   }
   
   void DebugPrintKeys() {
+    // Most recently used first, across all priorities
+    std::vector<const CacheEntry*> entries;
+    for (const auto& item : cache) {
+        entries.push_back(&item.second);
+    }
+    std::sort(entries.begin(), entries.end(), [](const CacheEntry* a, const CacheEntry* b) {
+        return a->lastUsed > b->lastUsed;
+    });
     std::cout << "Keys in cache: ";
-    for (const auto& key : lru_list) {
-        std::cout << key << " ";
+    for (const CacheEntry* entry : entries) {
+        std::cout << entry->key << " ";
     }
     std::cout << std::endl;
   }
   
   
+  // Each eviction is O(log n): the earliest expiry is expiry_index.begin(),
+  // the victim otherwise is the back of the lowest priority's LRU list.
   void EvictItems() {
-    // TODO(interviewee): implement this
-    while (cache.size() > maxItems) {
+    while (cache.size() > static_cast<size_t>(std::max(maxItems, 0))) {
         // 1. Evict expired items
-        bool evicted = false;
-        for (auto it = cache.begin(); it != cache.end(); ) {
-            if (it->second.expiryTime <= g_Time) {
-                lru_list.erase(it->second.list_iterator);
-                it = cache.erase(it);
-                evicted = true;
-                break;
-            } else {
-                ++it;
-            }
+        if (expiry_index.begin()->first <= g_Time) {
+            Remove(cache.find(expiry_index.begin()->second));
+            continue;
         }
-        if (evicted) continue;
 
         // 2. Evict lowest priority, least recently used
-        if (!lru_list.empty()) {
-            
-            std::string key_to_remove = lru_list.back();
-            int min_priority = cache[key_to_remove].priority;
-            
-            for(const auto& key : lru_list) {
-                if(cache[key].priority < min_priority) {
-                    min_priority = cache[key].priority;
-                    key_to_remove = key;
-                }
-            }
-            
-            
-            lru_list.remove(key_to_remove);
-            cache.erase(key_to_remove);
-        }
+        Remove(cache.find(lru_lists.begin()->second.back()));
+    }
+  }
+
+  private:
+  void Touch(CacheEntry& entry) {
+    std::list<std::string>& lru_list = lru_lists[entry.priority];
+    lru_list.splice(lru_list.begin(), lru_list, entry.list_iterator);
+    entry.lastUsed = ++useCounter;
+  }
+
+  // Take the entry out of its LRU list, dropping the list once it is empty
+  void Unlink(CacheEntry& entry) {
+    auto list_it = lru_lists.find(entry.priority);
+    list_it->second.erase(entry.list_iterator);
+    if (list_it->second.empty()) {
+        lru_lists.erase(list_it);
     }
   }
+
+  void Remove(std::unordered_map<std::string, CacheEntry>::iterator it) {
+    Unlink(it->second);
+    expiry_index.erase(it->second.expiry_iterator);
+    cache.erase(it);
+  }
 };
 
 
+// Regression check for eviction cost: shrink a 1M-entry cache by 10%, part
+// of it by expiry and the rest by priority. Was O(k * n) with full scans.
+void evictiontest() {
+  const int numEntries = 1000000;
+  const int numPrioritys = 20;
+  PriorityExpiryCache c(numEntries);
+  srand(1);
+  for (int i = 0; i < numEntries; ++i) {
+    c.Set("Key" + std::to_string(i), i, rand() % numPrioritys, 1 + rand() % 1000);
+  }
+
+  g_Time += 50; // About 5% of the entries are now expired
+  auto start = std::chrono::high_resolution_clock::now();
+  c.SetMaxItems(numEntries - numEntries / 10);
+  auto end = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> duration = end - start;
+  std::cout << "Evicting " << numEntries / 10 << " of " << numEntries << " entries took: "
+            << duration.count() << " seconds (" << c.cache.size() << " left)" << std::endl;
+}
+
 int main() {
   PriorityExpiryCache c(5);
   c.Set("A", 1, 5,  100 );
@@ -215,6 +257,8 @@ int main() {
   // Keys in C = ["C"]
   // "E" is removed because C is more recently used (due to the Get("C") event).
   c.DebugPrintKeys();
+
+  evictiontest();
   
   return 0;
 }
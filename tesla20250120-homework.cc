@@ -26,276 +26,5678 @@ p5 => priority 5
 e10 => expires at 10 seconds since epoch
 */
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <functional>
+#include <future>
 #include <iostream>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <queue>
+#include <random>
 #include <set>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 #include <chrono>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 int g_Time = 0;
 typedef int CacheData;
 
-class PriorityExpiryCache
+// A point in time in some clock's ticks; 64 bits, so millisecond clocks
+// never wrap
+typedef int64_t CacheTime;
+
+// Which structure orders entries by expiry time
+enum class ExpiryIndex
+{
+  Heap,        // Binary min-heap, O(log n) insert/cancel/expire
+  TimingWheel, // Hierarchical timing wheel, amortized O(1) insert/cancel/expire
+};
+
+// How Get records that an entry was used
+enum class Recency
+{
+  ExactLRU, // Get moves the entry to the front of its priority's LRU list
+  Clock,    // Get only sets a referenced bit; eviction gives marked entries a second chance
+};
+
+// Which new keys are let in when the cache is full
+enum class Admission
+{
+  Always,  // Every write is stored; eviction makes room
+  TinyLFU, // A new key must be used more often than the entry it would displace
+};
+
+// How BasicShardedPriorityExpiryCache::Get reaches an entry
+enum class ReadMode
+{
+  Locked,   // Get takes the shard mutex like every other call
+  LockFree, // Get reads optimistically under a seqlock and queues the hit for the next writer
+};
+
+// Construction-time knobs; the defaults reproduce the original behaviour
+struct CacheOptions
+{
+  ExpiryIndex expiryIndex = ExpiryIndex::Heap;
+
+  // Priorities in [0, densePriorities) get a fixed bucket array with a
+  // bitmap, so the lowest non-empty priority is found with two ctz's.
+  // Anything outside the range (or everything, when 0) uses the sparse
+  // std::set. At most BasicPriorityExpiryCache::kMaxDensePriorities.
+  int densePriorities = 0;
+
+  // Most expired entries a write reclaims beyond what it needs to stay
+  // within maxItems; 0 drains every expired entry on each write. With a
+  // budget, the rest is left to ReapExpired() and to lazy expiry in Get.
+  size_t reapBudget = 0;
+
+  // Byte budget on top of maxItems; 0 means no byte limit. Every entry is
+  // charged its node plus what the Weigher says, and eviction runs until
+  // both the item count and the total charge fit.
+  size_t maxBytes = 0;
+
+  // With Recency::Clock a Get hit writes at most one bit and never touches
+  // the lists, and the order within a priority approximates LRU (CLOCK).
+  // lastAccessTime then only changes on writes.
+  Recency recency = Recency::ExactLRU;
+
+  // With Admission::TinyLFU every Get and Set is counted in a small
+  // frequency sketch, and a new key that would force out a live entry of
+  // its own priority is dropped unless it has been seen more often. Expired
+  // entries and lower priorities still go first, exactly as without it.
+  Admission admission = Admission::Always;
+
+  // ReadMode::LockFree is for the sharded cache and needs a trivially
+  // copyable value type and a clock that may be read from any thread (not
+  // ManualClock). The cache itself then frees removed nodes and index
+  // tables only when told to, since a reader may still be looking at them.
+  ReadMode readMode = ReadMode::Locked;
+
+  // Refresh-ahead window as a fraction of each entry's TTL; 0 turns it
+  // off. A Get hit with at most this fraction of its TTL left reports that
+  // a reload is due; the sharded cache runs it in the background (see
+  // SetRefreshLoader) and serves the old value meanwhile. Entries nobody
+  // reads in the window expire as usual.
+  double refreshAhead = 0;
+};
+
+// A Clock is any copyable type with CacheTime Now() const and the tick rate
+// kTicksPerSecond. The cache keeps every time in ticks, turns TTLs given in
+// seconds into ticks, and sizes its timing wheel from the rate.
+
+// Reads the process-wide simulated clock g_Time (integer seconds)
+struct GlobalClock
+{
+  static constexpr CacheTime kTicksPerSecond = 1;
+
+  CacheTime Now() const
+  {
+    return g_Time;
+  }
+};
+
+// A millisecond clock owned by one cache and moved by hand, for tests and
+// for caches that must not share a time source
+class ManualClock
+{
+  private:
+  CacheTime now = 0;
+
+  public:
+  static constexpr CacheTime kTicksPerSecond = 1000;
+
+  CacheTime Now() const
+  {
+    return now;
+  }
+
+  void Advance(int secs)
+  {
+    now += secs * kTicksPerSecond;
+  }
+
+  void AdvanceMillis(CacheTime millis)
+  {
+    now += millis;
+  }
+};
+
+// Monotonic milliseconds, cached: a thread re-reads steady_clock once per
+// period and publishes it in an atomic, so readers pay one relaxed load
+// and no clock_gettime. Readers may see time up to one period late.
+class CoarseTicker
+{
+  private:
+  std::atomic<CacheTime> now;
+  std::atomic<bool> stopping{false};
+  std::thread thread;
+
+  static CacheTime ReadMillis()
+  {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  public:
+  explicit CoarseTicker(std::chrono::milliseconds period = std::chrono::milliseconds(1)) : now(ReadMillis())
+  {
+    thread = std::thread([this, period]() {
+      while (!stopping.load(std::memory_order_relaxed))
+      {
+        std::this_thread::sleep_for(period);
+        now.store(ReadMillis(), std::memory_order_relaxed);
+      }
+    });
+  }
+
+  ~CoarseTicker()
+  {
+    stopping.store(true);
+    thread.join();
+  }
+
+  CoarseTicker(const CoarseTicker &) = delete;
+  CoarseTicker &operator=(const CoarseTicker &) = delete;
+
+  CacheTime Now() const
+  {
+    return now.load(std::memory_order_relaxed);
+  }
+
+  // One ticker for the whole process, started on first use
+  static CoarseTicker &Default()
+  {
+    static CoarseTicker ticker;
+    return ticker;
+  }
+};
+
+// The production clock: monotonic milliseconds from a CoarseTicker, the
+// shared one unless a cache is given its own. steady_clock counts from
+// boot, so times (and snapshots) stay valid across restarts but not reboots.
+struct CoarseClock
+{
+  static constexpr CacheTime kTicksPerSecond = 1000;
+
+  const CoarseTicker *ticker = &CoarseTicker::Default();
+
+  CacheTime Now() const
+  {
+    return ticker->Now();
+  }
+};
+
+// std::hash is the identity for integers in libstdc++, which clusters
+// strided keys in a power-of-two table. Mix the bits first.
+struct IntegerHash
+{
+  size_t operator()(uint64_t x) const
+  {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return x;
+  }
+};
+
+// How the cache stores, passes and hashes a key, picked at compile time.
+// Generic keys are passed by const reference and keep their hash in the
+// node so rehashing and lookups never call Hash on a stored key.
+template <typename Key, typename Enable = void>
+struct KeyTraits
+{
+  typedef const Key &View;
+  typedef std::hash<Key> DefaultHash;
+  static constexpr bool kStoreHash = true;
+  static constexpr bool kSnapshot = false; // No byte encoding; SaveSnapshot is unavailable
+
+  static size_t HeapBytes(const Key &)
+  {
+    return 0;
+  }
+};
+
+// Trivially copyable keys (integers, small PODs) are passed by value and
+// compared directly; re-hashing them is cheaper than storing the hash, so
+// their nodes carry neither a string nor a cached hash.
+template <typename Key>
+struct KeyTraits<Key, typename std::enable_if<std::is_trivially_copyable<Key>::value>::type>
+{
+  typedef Key View;
+  typedef typename std::conditional<std::is_integral<Key>::value, IntegerHash, std::hash<Key>>::type DefaultHash;
+  static constexpr bool kStoreHash = false;
+  static constexpr bool kSnapshot = true;
+
+  static size_t HeapBytes(const Key &)
+  {
+    return 0;
+  }
+
+  // Snapshot encoding: the key's own bytes
+  static size_t SnapshotSize(View)
+  {
+    return sizeof(Key);
+  }
+
+  static void SnapshotWrite(View key, char *out)
+  {
+    memcpy(out, &key, sizeof(Key));
+  }
+
+  static Key SnapshotRead(const char *in, size_t)
+  {
+    Key key;
+    memcpy(&key, in, sizeof(Key));
+    return key;
+  }
+};
+
+// std::string keys are looked up through std::string_view, so a lookup
+// never builds a std::string; the key is copied only into a new node.
+template <>
+struct KeyTraits<std::string>
+{
+  typedef std::string_view View;
+  typedef std::hash<std::string_view> DefaultHash;
+  static constexpr bool kStoreHash = true;
+  static constexpr bool kSnapshot = true;
+
+  // Characters that did not fit in the small-string buffer
+  static size_t HeapBytes(const std::string &key)
+  {
+    return key.capacity() > std::string().capacity() ? key.capacity() + 1 : 0;
+  }
+
+  // Snapshot encoding: the characters; reading points into the mapped file
+  static size_t SnapshotSize(View key)
+  {
+    return key.size();
+  }
+
+  static void SnapshotWrite(View key, char *out)
+  {
+    memcpy(out, key.data(), key.size());
+  }
+
+  static View SnapshotRead(const char *in, size_t length)
+  {
+    return View(in, length);
+  }
+};
+
+// Operations the latency stats keep a histogram for
+enum class CacheOp
+{
+  GetHit,
+  GetMiss,
+  SetInsert,  // Set/Emplace/MultiSet write of a new key
+  SetUpdate,  // Same, for a key that was already present
+  EvictItems, // One eviction pass after a write or a SetMaxItems
+  Count,
+};
+
+// Why an entry left the cache, or for Replaced why its old value did
+enum class EvictReason
+{
+  Expired,  // Reaped, evicted or found by Get after its expiry time
+  Capacity, // Lowest priority, least recently used entry over maxItems
+  Replaced, // Value overwritten by Set/Emplace/MultiSet; the key stays
+  Explicit, // Removed by Remove or Clear
+  Rejected, // New key turned away by the admission filter; never stored
+  Count,
+};
+
+inline const char *EvictReasonName(EvictReason reason)
+{
+  static const char *const names[] = {"expired", "capacity", "replaced", "explicit", "rejected"};
+  return names[static_cast<size_t>(reason)];
+}
+
+// The default Stats policy: empty hooks and kEnabled = false, so the cache
+// never reads the time for stats and the instrumentation compiles away
+struct NullCacheStats
+{
+  static constexpr bool kEnabled = false;
+
+  void RecordLatency(CacheOp, uint64_t) {}
+  void RecordEviction(EvictReason) {}
+};
+
+// The default Listener policy: kEnabled = false, so nothing is moved out of
+// a node before it is freed. A listener is any copyable type with the same
+// OnEviction, called with the key and value moved out of the cache (the key
+// is a copy for Replaced) and the entry's priority and absolute expiry
+// time. It runs under the caller's Get/Set, so it should only hand the
+// entry off or buffer it; see WriteBehindListener and the tiered cache.
+// The destructor reports nothing; call Clear() first to hand off the rest.
+struct NullEvictionListener
+{
+  static constexpr bool kEnabled = false;
+
+  template <typename Key, typename Value>
+  void OnEviction(Key &&, Value &&, int, CacheTime, EvictReason) {}
+};
+
+// Log-bucketed (HDR-style) histogram of nanosecond latencies. Values below
+// 2^kSubBits get a bucket each; above that every power of two is split into
+// 2^kSubBits buckets, so a reported value is within 1/16 of the true one
+// over the whole uint64_t range, in a fixed 976-bucket array.
+class LatencyHistogram
+{
+  private:
+  static constexpr int kSubBits = 4;
+  static constexpr int kBuckets = (64 - kSubBits + 1) << kSubBits;
+
+  std::array<uint64_t, kBuckets> counts{};
+  uint64_t total = 0;
+  uint64_t sum = 0;
+  uint64_t maxValue = 0;
+
+  static int BucketOf(uint64_t value)
+  {
+    if (value < (1ull << kSubBits))
+    {
+      return static_cast<int>(value);
+    }
+    int shift = 63 - __builtin_clzll(value) - kSubBits;
+    return ((shift + 1) << kSubBits) + static_cast<int>((value >> shift) & ((1 << kSubBits) - 1));
+  }
+
+  // Largest value that lands in the bucket
+  static uint64_t BucketTop(int bucket)
+  {
+    if (bucket < (1 << kSubBits))
+    {
+      return bucket;
+    }
+    int shift = (bucket >> kSubBits) - 1;
+    uint64_t low = static_cast<uint64_t>((1 << kSubBits) + (bucket & ((1 << kSubBits) - 1))) << shift;
+    return low + ((1ull << shift) - 1);
+  }
+
+  public:
+  void Record(uint64_t ns)
+  {
+    ++counts[BucketOf(ns)];
+    ++total;
+    sum += ns;
+    maxValue = std::max(maxValue, ns);
+  }
+
+  void Merge(const LatencyHistogram &other)
+  {
+    for (int i = 0; i < kBuckets; ++i)
+    {
+      counts[i] += other.counts[i];
+    }
+    total += other.total;
+    sum += other.sum;
+    maxValue = std::max(maxValue, other.maxValue);
+  }
+
+  uint64_t Count() const
+  {
+    return total;
+  }
+
+  uint64_t Max() const
+  {
+    return maxValue;
+  }
+
+  double Mean() const
+  {
+    return total == 0 ? 0.0 : static_cast<double>(sum) / total;
+  }
+
+  // Smallest bucket bound at or above a fraction q of the recorded values
+  uint64_t Percentile(double q) const
+  {
+    if (total == 0)
+    {
+      return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * total + 0.5));
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; ++i)
+    {
+      seen += counts[i];
+      if (seen >= rank)
+      {
+        return std::min(BucketTop(i), maxValue);
+      }
+    }
+    return maxValue;
+  }
+};
+
+// Stats policy that times every operation and counts evictions by reason.
+// Adds two steady_clock reads per operation; dump with PrintText/PrintJson.
+class CacheLatencyStats
+{
+  private:
+  std::array<LatencyHistogram, static_cast<size_t>(CacheOp::Count)> histograms;
+  std::array<uint64_t, static_cast<size_t>(EvictReason::Count)> evictions{};
+
+  static const char *Name(CacheOp op)
+  {
+    static const char *const names[] = {"get_hit", "get_miss", "set_insert", "set_update", "evict_items"};
+    return names[static_cast<size_t>(op)];
+  }
+
+  public:
+  static constexpr bool kEnabled = true;
+
+  void RecordLatency(CacheOp op, uint64_t ns)
+  {
+    histograms[static_cast<size_t>(op)].Record(ns);
+  }
+
+  void RecordEviction(EvictReason reason)
+  {
+    ++evictions[static_cast<size_t>(reason)];
+  }
+
+  const LatencyHistogram &Histogram(CacheOp op) const
+  {
+    return histograms[static_cast<size_t>(op)];
+  }
+
+  uint64_t Evictions(EvictReason reason) const
+  {
+    return evictions[static_cast<size_t>(reason)];
+  }
+
+  // Fold in another cache's stats, e.g. one per shard
+  void Merge(const CacheLatencyStats &other)
+  {
+    for (size_t i = 0; i < histograms.size(); ++i)
+    {
+      histograms[i].Merge(other.histograms[i]);
+    }
+    for (size_t i = 0; i < evictions.size(); ++i)
+    {
+      evictions[i] += other.evictions[i];
+    }
+  }
+
+  void PrintText(std::ostream &out) const
+  {
+    for (size_t i = 0; i < histograms.size(); ++i)
+    {
+      const LatencyHistogram &h = histograms[i];
+      out << Name(static_cast<CacheOp>(i)) << ": count " << h.Count() << ", mean " << static_cast<uint64_t>(h.Mean())
+          << " ns, p50 " << h.Percentile(0.5) << ", p99 " << h.Percentile(0.99) << ", p999 " << h.Percentile(0.999)
+          << ", max " << h.Max() << " ns" << std::endl;
+    }
+    out << "evictions:";
+    for (size_t i = 0; i < evictions.size(); ++i)
+    {
+      out << (i ? ", " : " ") << EvictReasonName(static_cast<EvictReason>(i)) << " " << evictions[i];
+    }
+    out << std::endl;
+  }
+
+  // One JSON object on one line, latencies in nanoseconds
+  void PrintJson(std::ostream &out) const
+  {
+    out << "{\"latency_ns\":{";
+    for (size_t i = 0; i < histograms.size(); ++i)
+    {
+      const LatencyHistogram &h = histograms[i];
+      out << (i ? "," : "") << "\"" << Name(static_cast<CacheOp>(i)) << "\":{\"count\":" << h.Count()
+          << ",\"mean\":" << static_cast<uint64_t>(h.Mean()) << ",\"p50\":" << h.Percentile(0.5)
+          << ",\"p90\":" << h.Percentile(0.9) << ",\"p99\":" << h.Percentile(0.99)
+          << ",\"p999\":" << h.Percentile(0.999) << ",\"max\":" << h.Max() << "}";
+    }
+    out << "},\"evictions\":{";
+    for (size_t i = 0; i < evictions.size(); ++i)
+    {
+      out << (i ? "," : "") << "\"" << EvictReasonName(static_cast<EvictReason>(i)) << "\":" << evictions[i];
+    }
+    out << "}}" << std::endl;
+  }
+};
+
+// The default Weigher: heap bytes a key or value owns beyond its sizeof,
+// which the node already covers. A custom Weigher is any callable
+// (const Key &, const Value &) -> size_t returning a caller-defined weight
+// in bytes, e.g. a serialized size carried by the value.
+struct DefaultWeigher
+{
+  template <typename Key, typename Value>
+  size_t operator()(const Key &key, const Value &value) const
+  {
+    return KeyTraits<Key>::HeapBytes(key) + HeapBytes(value);
+  }
+
+  private:
+  template <typename T>
+  static size_t HeapBytes(const T &)
+  {
+    return 0;
+  }
+
+  static size_t HeapBytes(const std::string &value)
+  {
+    return KeyTraits<std::string>::HeapBytes(value);
+  }
+
+  template <typename T>
+  static size_t HeapBytes(const std::vector<T> &value)
+  {
+    return value.capacity() * sizeof(T);
+  }
+};
+
+// Count-min sketch of recent key frequencies for TinyLFU admission. Four
+// rows of 4-bit counters, sixteen to a 64-bit word; a key's estimate is the
+// smallest of its four counters. After 10 increments per tracked entry every
+// counter is halved, so popularity fades and a key that was hot an hour ago
+// cannot keep newer keys out forever. About 2 bytes per cache entry.
+class FrequencySketch
+{
+  private:
+  static constexpr int kRows = 4;
+  static constexpr size_t kMaxWidth = size_t(1) << 22; // Counters per row; caps the table at 8 MB
+  static constexpr uint64_t kSeeds[kRows] = {0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull,
+                                             0xD6E8FEB86659FD93ull};
+
+  std::vector<uint64_t> table; // Row r's counters live in words [r * width / 16, (r + 1) * width / 16)
+  int widthBits = 0;
+  size_t additions = 0;
+  size_t sampleSize = 0;
+
+  size_t CounterIndex(size_t hash, int row) const
+  {
+    return (size_t(row) << widthBits) + static_cast<size_t>((hash * kSeeds[row]) >> (64 - widthBits));
+  }
+
+  int Counter(size_t index) const
+  {
+    return static_cast<int>((table[index / 16] >> (4 * (index % 16))) & 0xf);
+  }
+
+  // Halve every counter at once; 0x7777... drops the bit each counter
+  // shifted in from its neighbour
+  void Age()
+  {
+    for (uint64_t &word : table)
+    {
+      word = (word >> 1) & 0x7777777777777777ull;
+    }
+    additions /= 2;
+  }
+
+  public:
+  // Size for about capacity distinct hot keys; forgets every count
+  void Resize(size_t capacity)
+  {
+    size_t width = 16;
+    widthBits = 4;
+    while (width < capacity && width < kMaxWidth)
+    {
+      width *= 2;
+      ++widthBits;
+    }
+    table.assign(kRows * width / 16, 0);
+    additions = 0;
+    sampleSize = 10 * std::max<size_t>(1, std::min(capacity, width));
+  }
+
+  void Increment(size_t hash)
+  {
+    bool added = false;
+    for (int row = 0; row < kRows; ++row)
+    {
+      size_t index = CounterIndex(hash, row);
+      if (Counter(index) < 15)
+      {
+        table[index / 16] += uint64_t(1) << (4 * (index % 16));
+        added = true;
+      }
+    }
+    if (added && ++additions >= sampleSize)
+    {
+      Age();
+    }
+  }
+
+  int Frequency(size_t hash) const
+  {
+    int frequency = 15;
+    for (int row = 0; row < kRows; ++row)
+    {
+      frequency = std::min(frequency, Counter(CounterIndex(hash, row)));
+    }
+    return frequency;
+  }
+
+  size_t Bytes() const
+  {
+    return table.capacity() * sizeof(uint64_t);
+  }
+};
+
+template <typename Key, typename Value, typename Hash = typename KeyTraits<Key>::DefaultHash, typename Clock = GlobalClock,
+          typename Stats = NullCacheStats, typename Weigher = DefaultWeigher, typename Listener = NullEvictionListener>
+class BasicPriorityExpiryCache
+{
+  public:
+  typedef Key KeyType;
+  typedef Value ValueType;
+  typedef Clock ClockType;
+  typedef Stats StatsType;
+  typedef Listener ListenerType;
+  typedef typename KeyTraits<Key>::View KeyView;
+
+  // One write for MultiSet
+  struct Write
+  {
+    KeyView key;
+    Value value;
+    int priority;
+    int expiryInSecs;
+  };
+
+  private:
+  static constexpr bool kStoreHash = KeyTraits<Key>::kStoreHash;
+
+  // Only nodes of keys that keep their hash get the field
+  template <bool Store, typename Dummy = void>
+  struct StoredHash
+  {
+    size_t hash;
+    explicit StoredHash(size_t h) : hash(h) {}
+  };
+
+  template <typename Dummy>
+  struct StoredHash<false, Dummy>
+  {
+    explicit StoredHash(size_t) {}
+  };
+
+  // One node per entry. The key is stored exactly once; the hash index, the
+  // per-priority LRU list and the expiry index all point at the node itself.
+  struct Node : StoredHash<kStoreHash>
+  {
+    Key key;
+    Value value;
+    int priority;
+    CacheTime expiryTime;     // In clock ticks
+    CacheTime lastAccessTime;
+
+    Node *lruPrev;   // Towards the most recently used end
+    Node *lruNext;   // Towards the least recently used end
+    uint32_t expiryPos; // Slot in expiryHeap
+    uint32_t ttl;       // Ticks from the last write to expiryTime, saturated; for refresh-ahead
+
+    Node *wheelNext;   // Next node in the same timing wheel bucket
+    Node **wheelPprev; // Link that points at this node
+    int8_t wheelLevel;  // Wheel level holding this node, or a TimingWheel::k* list
+    bool referenced;    // Read since it last reached the LRU tail, in Recency::Clock mode
+    bool retired;       // Removed, but kept for lock-free readers (ReadMode::LockFree)
+    std::atomic<bool> refreshing; // A refresh-ahead reload was claimed since the last write
+    uint32_t charge;    // Bytes counted against maxBytes
+
+    // The value is constructed directly from args, in the pooled slot
+    template <typename... Args>
+    Node(KeyView k, size_t h, Args &&...args)
+        : StoredHash<kStoreHash>(h), key(k), value(std::forward<Args>(args)...), priority(0), expiryTime(0), lastAccessTime(0),
+          lruPrev(nullptr), lruNext(nullptr), expiryPos(0), ttl(0),
+          wheelNext(nullptr), wheelPprev(nullptr), wheelLevel(0), referenced(false), retired(false), refreshing(false),
+          charge(0) {}
+
+    bool isExpired(CacheTime now) const
+    {
+      return expiryTime < now;
+    }
+  };
+
+  // Hands out node-sized slots carved from large chunks and recycles freed
+  // slots through a free list, so steady-state Set does not hit malloc.
+  class NodePool
+  {
+    private:
+    union Slot
+    {
+      Slot *next;
+      alignas(Node) char storage[sizeof(Node)];
+    };
+    // About 256 KB per chunk, whether nodes hold an int or a 4 KB blob
+    static constexpr size_t kSlotsPerChunk = std::max<size_t>(16, (256 << 10) / sizeof(Slot));
+
+    std::vector<std::unique_ptr<Slot[]>> chunks;
+    Slot *freeList = nullptr;
+    size_t usedInLastChunk = kSlotsPerChunk;
+
+    public:
+    void *Allocate()
+    {
+      if (freeList != nullptr)
+      {
+        Slot *slot = freeList;
+        freeList = slot->next;
+        return slot;
+      }
+      if (usedInLastChunk == kSlotsPerChunk)
+      {
+        chunks.emplace_back(new Slot[kSlotsPerChunk]);
+        usedInLastChunk = 0;
+      }
+      return &chunks.back()[usedInLastChunk++];
+    }
+
+    void Free(void *p)
+    {
+      Slot *slot = static_cast<Slot *>(p);
+      slot->next = freeList;
+      freeList = slot;
+    }
+
+    size_t BytesReserved() const
+    {
+      return chunks.size() * kSlotsPerChunk * sizeof(Slot);
+    }
+  };
+
+  // The expiry heap's array: node pointers in fixed 32 KB blocks. Growing
+  // adds a block and never moves the ones already filled, so no Set pays
+  // for copying the whole heap the way a doubling std::vector makes one
+  // Set do; only the table of blocks (1/4096 the size) ever doubles.
+  class BlockArray
+  {
+    private:
+    static constexpr size_t kBlockShift = 12;
+    static constexpr size_t kBlockSlots = size_t(1) << kBlockShift;
+
+    std::vector<std::unique_ptr<Node *[]>> blocks;
+    size_t count = 0;
+
+    public:
+    size_t size() const
+    {
+      return count;
+    }
+
+    bool empty() const
+    {
+      return count == 0;
+    }
+
+    size_t capacity() const
+    {
+      return blocks.size() * kBlockSlots;
+    }
+
+    Node *&operator[](size_t pos)
+    {
+      return blocks[pos >> kBlockShift][pos & (kBlockSlots - 1)];
+    }
+
+    Node *operator[](size_t pos) const
+    {
+      return blocks[pos >> kBlockShift][pos & (kBlockSlots - 1)];
+    }
+
+    Node *front() const
+    {
+      return blocks[0][0];
+    }
+
+    void reserve(size_t n)
+    {
+      while (capacity() < n)
+      {
+        blocks.emplace_back(new Node *[kBlockSlots]);
+      }
+    }
+
+    void push_back(Node *node)
+    {
+      reserve(count + 1);
+      (*this)[count++] = node;
+    }
+
+    // Blocks are kept, like a vector's capacity
+    void pop_back()
+    {
+      --count;
+    }
+  };
+
+  // Doubly linked LRU list threaded through Node::lruPrev/lruNext
+  struct LruList
+  {
+    Node *head = nullptr; // Most recently used
+    Node *tail = nullptr; // Least recently used
+
+    bool empty() const
+    {
+      return head == nullptr;
+    }
+
+    void PushFront(Node *node)
+    {
+      node->lruPrev = nullptr;
+      node->lruNext = head;
+      if (head != nullptr)
+      {
+        head->lruPrev = node;
+      }
+      else
+      {
+        tail = node;
+      }
+      head = node;
+    }
+
+    void Unlink(Node *node)
+    {
+      (node->lruPrev != nullptr ? node->lruPrev->lruNext : head) = node->lruNext;
+      (node->lruNext != nullptr ? node->lruNext->lruPrev : tail) = node->lruPrev;
+      node->lruPrev = node->lruNext = nullptr;
+    }
+  };
+
+  // Open-addressing index over the nodes, Swiss-table style, laid out so
+  // a group is exactly one cache line: 7 control bytes, an overflow byte
+  // and 7 node pointers. A full slot's control byte is 0x80 | a 7-bit tag
+  // from the hash, an empty one is 0, and a probe compares all 7 tags at
+  // once (SSE2 where available), so a hit costs the group line and the
+  // node. Groups are probed in triangular order from the one picked by the
+  // high hash bits. An insert that passes a full group sets one of its 8
+  // overflow bits, chosen by the hash; a lookup stops at the first group
+  // whose bit for its hash is clear, so most misses read one line and
+  // erase needs no tombstones.
+  //
+  // Growing is incremental: the new table is mapped (O(1), its pages are
+  // zero until touched) and every Insert or Erase moves a few groups of
+  // the old one across, so no single write pays for the whole rehash.
+  // Until the old table is drained a lookup checks both.
+  //
+  // With DeferFree(true) no table is unmapped while in use: replaced
+  // tables wait in a list until FreeRetired(), so a reader racing the
+  // writer (FindConcurrent) never touches an unmapped page.
+  class SwissIndex
+  {
+    private:
+    static constexpr int kGroupSlots = 7;
+    static constexpr uint32_t kSlotMask = (1u << kGroupSlots) - 1;
+    static constexpr size_t kMigrateGroups = 2;   // Old groups moved per write
+    static constexpr size_t kReleaseGroups = 1024; // Drained old groups unmapped at a time (64 KB)
+    static constexpr size_t kBulkPrefetch = 16;    // How far InsertBulk prefetches ahead
+
+    struct alignas(64) Group
+    {
+      uint8_t ctrl[kGroupSlots];
+      uint8_t overflow;
+      Node *slots[kGroupSlots];
+    };
+
+    // A power-of-two array of groups in its own anonymous mapping, so a
+    // new table starts out all empty without being written
+    class Table
+    {
+      public:
+      Group *groups = nullptr;
+      size_t numGroups = 0;
+      size_t released = 0; // Leading groups already unmapped
+
+      Table() = default;
+
+      // populate faults every page in up front, for a table about to be filled
+      explicit Table(size_t numGroups, bool populate = false) : numGroups(numGroups)
+      {
+        void *mapped = mmap(nullptr, numGroups * sizeof(Group), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | (populate ? MAP_POPULATE : 0), -1, 0);
+        if (mapped == MAP_FAILED)
+        {
+          throw std::bad_alloc();
+        }
+        groups = static_cast<Group *>(mapped);
+      }
+
+      Table(Table &&other) : groups(other.groups), numGroups(other.numGroups), released(other.released)
+      {
+        other.groups = nullptr;
+        other.numGroups = other.released = 0;
+      }
+
+      Table &operator=(Table &&other)
+      {
+        std::swap(groups, other.groups);
+        std::swap(numGroups, other.numGroups);
+        std::swap(released, other.released);
+        return *this;
+      }
+
+      ~Table()
+      {
+        if (groups != nullptr && released < numGroups)
+        {
+          munmap(groups + released, Bytes());
+        }
+      }
+
+      // Bytes still mapped
+      size_t Bytes() const
+      {
+        return (numGroups - released) * sizeof(Group);
+      }
+
+      // Give back the next count groups' pages; they must not be read again.
+      // The range may be mapped again by anyone, so it is never unmapped twice.
+      void Release(size_t count)
+      {
+        munmap(groups + released, count * sizeof(Group));
+        released += count;
+      }
+    };
+
+    Table table;
+    Table old;            // Being drained into table, or empty
+    size_t migrated = 0;  // Groups of old already moved
+    size_t size = 0;      // Nodes in both tables
+    size_t growthLeft = 0; // Inserts left before table needs a rehash
+    bool deferFree = false;
+    std::vector<Table> retired; // Dropped tables not yet unmapped, oldest first
+
+    static uint8_t Tag(size_t hash)
+    {
+      return static_cast<uint8_t>(0x80 | (hash & 0x7f));
+    }
+
+    static uint8_t OverflowBit(size_t hash)
+    {
+      return static_cast<uint8_t>(1u << ((hash >> 7) & 7));
+    }
+
+    static size_t GroupOf(size_t numGroups, size_t hash)
+    {
+      return (hash >> 10) & (numGroups - 1);
+    }
+
+    // Bit i set <=> ctrl[i] == tag
+    static uint32_t Match(const Group &group, uint8_t tag)
+    {
+#if defined(__SSE2__)
+      __m128i ctrl = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(group.ctrl));
+      return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(static_cast<char>(tag))))) &
+             kSlotMask;
+#else
+      uint32_t bits = 0;
+      for (int i = 0; i < kGroupSlots; ++i)
+      {
+        bits |= uint32_t(group.ctrl[i] == tag) << i;
+      }
+      return bits;
+#endif
+    }
+
+    // Bit i set <=> slot i is empty, i.e. the top bit of its control byte is clear
+    static uint32_t MatchEmpty(const Group &group)
+    {
+#if defined(__SSE2__)
+      __m128i ctrl = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(group.ctrl));
+      return ~static_cast<uint32_t>(_mm_movemask_epi8(ctrl)) & kSlotMask;
+#else
+      uint32_t bits = 0;
+      for (int i = 0; i < kGroupSlots; ++i)
+      {
+        bits |= uint32_t(group.ctrl[i] < 0x80) << i;
+      }
+      return bits;
+#endif
+    }
+
+    // At most 3/4 of the slots are counted as used; with 7 slots a group
+    // fuller than that would overflow too often
+    static size_t MaxLoad(size_t numGroups)
+    {
+      return numGroups * kGroupSlots * 3 / 4;
+    }
+
+    // Groups below skipBelow have been moved out (and maybe unmapped): the
+    // probe steps over them without reading, as if their overflow bits
+    // were all set, and only stops in a group that is still in place.
+    template <typename Matches>
+    static Node *FindIn(const Group *groups, size_t numGroups, size_t skipBelow, size_t hash, Matches matches)
+    {
+      uint8_t tag = Tag(hash);
+      size_t mask = numGroups - 1;
+      // The first numGroups steps visit every group once
+      for (size_t g = GroupOf(numGroups, hash), step = 1; step <= numGroups; g = (g + step++) & mask)
+      {
+        if (g < skipBelow)
+        {
+          continue;
+        }
+        const Group &group = groups[g];
+        for (uint32_t bits = Match(group, tag); bits != 0; bits &= bits - 1)
+        {
+          Node *node = group.slots[__builtin_ctz(bits)];
+          if (matches(node))
+          {
+            return node;
+          }
+        }
+        if ((group.overflow & OverflowBit(hash)) == 0)
+        {
+          return nullptr;
+        }
+      }
+      return nullptr;
+    }
+
+    // Place a node in the first group with room, marking the full groups
+    // it passes
+    static void PlaceIn(Table &t, Node *node, size_t hash)
+    {
+      size_t mask = t.numGroups - 1;
+      for (size_t g = GroupOf(t.numGroups, hash), step = 1;; g = (g + step++) & mask)
+      {
+        Group &group = t.groups[g];
+        uint32_t empty = MatchEmpty(group);
+        if (empty != 0)
+        {
+          int slot = __builtin_ctz(empty);
+          group.ctrl[slot] = Tag(hash);
+          group.slots[slot] = node;
+          return;
+        }
+        group.overflow |= OverflowBit(hash);
+      }
+    }
+
+    // Empty the node's slot if t holds it. Returns the slot's group, or
+    // nullptr if the node is not in t. skipBelow is as for FindIn.
+    static Group *EraseFrom(Table &t, size_t skipBelow, Node *node, size_t hash)
+    {
+      uint8_t tag = Tag(hash);
+      size_t mask = t.numGroups - 1;
+      for (size_t g = GroupOf(t.numGroups, hash), step = 1; step <= t.numGroups; g = (g + step++) & mask)
+      {
+        if (g < skipBelow)
+        {
+          continue;
+        }
+        Group &group = t.groups[g];
+        for (uint32_t bits = Match(group, tag); bits != 0; bits &= bits - 1)
+        {
+          int slot = __builtin_ctz(bits);
+          if (group.slots[slot] == node)
+          {
+            group.ctrl[slot] = 0;
+            return &group;
+          }
+        }
+        if ((group.overflow & OverflowBit(hash)) == 0)
+        {
+          return nullptr;
+        }
+      }
+      return nullptr;
+    }
+
+    // Move up to count groups of the old table into the new one, in index
+    // order. Lookups in old skip the moved groups, so their pages can be
+    // given back as the cursor passes them.
+    void Migrate(size_t count)
+    {
+      for (; count > 0 && migrated < old.numGroups; --count, ++migrated)
+      {
+        Group &group = old.groups[migrated];
+        for (uint32_t full = ~MatchEmpty(group) & kSlotMask; full != 0; full &= full - 1)
+        {
+          int slot = __builtin_ctz(full);
+          PlaceIn(table, group.slots[slot], HashOf(group.slots[slot]));
+          group.ctrl[slot] = 0;
+        }
+      }
+      if (migrated == old.numGroups)
+      {
+        Drop(old);
+        migrated = 0;
+      }
+      else if (!deferFree && migrated - old.released >= kReleaseGroups)
+      {
+        old.Release(kReleaseGroups);
+      }
+    }
+
+    // Empty t, unmapping it now or, with deferFree, once FreeRetired says so
+    void Drop(Table &t)
+    {
+      if (deferFree && t.numGroups != 0)
+      {
+        retired.push_back(std::move(t));
+      }
+      t = Table();
+    }
+
+    // Start moving everything into a table of numGroups groups
+    void StartRehash(size_t numGroups, bool populate = false)
+    {
+      Migrate(old.numGroups); // Finish the previous round first
+      old = std::move(table);
+      table = Table(numGroups, populate);
+      migrated = 0;
+      growthLeft = MaxLoad(numGroups) - size;
+    }
+
+    public:
+    // The node for which matches(node) holds among those with this hash
+    template <typename Matches>
+    Node *Find(size_t hash, Matches matches) const
+    {
+      Node *node = table.numGroups == 0 ? nullptr : FindIn(table.groups, table.numGroups, 0, hash, matches);
+      if (node == nullptr && old.numGroups != 0)
+      {
+        node = FindIn(old.groups, old.numGroups, migrated, hash, matches);
+      }
+      return node;
+    }
+
+    // Find for a reader that does not hold the writer's lock; needs
+    // DeferFree(true). stable() says whether any write may have overlapped
+    // the reads so far. The table fields are checked with it before a group
+    // is read, and a slot's node before it is handed to matches, so only
+    // nodes that were really in the index get dereferenced. If a write did
+    // overlap, the result is garbage and the caller must notice and retry.
+    template <typename Matches, typename Stable>
+    Node *FindConcurrent(size_t hash, Matches matches, Stable stable) const
+    {
+      const Group *groups = table.groups, *oldGroups = old.groups;
+      size_t numGroups = table.numGroups, oldNumGroups = old.numGroups, skipBelow = migrated;
+      if (!stable())
+      {
+        return nullptr;
+      }
+      auto checked = [&](const Node *node) { return !stable() || matches(node); };
+      Node *node = numGroups == 0 ? nullptr : FindIn(groups, numGroups, 0, hash, checked);
+      if (node == nullptr && oldNumGroups != 0)
+      {
+        node = FindIn(oldGroups, oldNumGroups, skipBelow, hash, checked);
+      }
+      return node;
+    }
+
+    // Add a node whose key is not in the index yet
+    void Insert(Node *node, size_t hash)
+    {
+      Migrate(kMigrateGroups);
+      if (growthLeft == 0)
+      {
+        // Grow unless the table is mostly stale overflow bits, which a
+        // same-size rehash clears; either way it ends up at most 5/8 full
+        size_t numGroups = std::max<size_t>(1, table.numGroups);
+        while ((size + 1) * 8 > numGroups * kGroupSlots * 5)
+        {
+          numGroups *= 2;
+        }
+        StartRehash(numGroups);
+      }
+      PlaceIn(table, node, hash);
+      --growthLeft;
+      ++size;
+    }
+
+    void Erase(Node *node, size_t hash)
+    {
+      if (old.numGroups == 0 || EraseFrom(old, migrated, node, hash) == nullptr)
+      {
+        // A slot freed in an overflowed group does not shorten any
+        // probe, so it is not given back until the next rehash
+        growthLeft += EraseFrom(table, 0, node, hash)->overflow == 0;
+      }
+      --size;
+      Migrate(kMigrateGroups);
+    }
+
+    // Size the table for n nodes up front, all at once, its pages faulted
+    // in by the one mmap
+    void Reserve(size_t n)
+    {
+      size_t numGroups = std::max<size_t>(1, table.numGroups);
+      while (MaxLoad(numGroups) < n)
+      {
+        numGroups *= 2;
+      }
+      if (numGroups != table.numGroups)
+      {
+        StartRehash(numGroups, true);
+      }
+      Migrate(old.numGroups);
+    }
+
+    // Insert nodes whose keys are not in the index yet, given with their
+    // hashes: one Reserve, then each node placed with no migration step or
+    // growth check, prefetching the group kBulkPrefetch nodes ahead
+    void InsertBulk(const std::vector<std::pair<size_t, Node *>> &nodes)
+    {
+      Reserve(size + nodes.size());
+      for (size_t i = 0; i < nodes.size(); ++i)
+      {
+        if (i + kBulkPrefetch < nodes.size())
+        {
+          __builtin_prefetch(&table.groups[GroupOf(table.numGroups, nodes[i + kBulkPrefetch].first)], 1);
+        }
+        PlaceIn(table, nodes[i].second, nodes[i].first);
+      }
+      size += nodes.size();
+      growthLeft -= std::min(growthLeft, nodes.size());
+    }
+
+    // Forget every node, keeping the capacity
+    void Clear()
+    {
+      size_t numGroups = table.numGroups;
+      Drop(table);
+      Drop(old);
+      if (numGroups != 0)
+      {
+        table = Table(numGroups);
+      }
+      migrated = size = 0;
+      growthLeft = MaxLoad(table.numGroups);
+    }
+
+    void DeferFree(bool on)
+    {
+      deferFree = on;
+    }
+
+    size_t RetiredTables() const
+    {
+      return retired.size();
+    }
+
+    // Unmap the count oldest retired tables
+    void FreeRetired(size_t count)
+    {
+      retired.erase(retired.begin(), retired.begin() + count);
+    }
+
+    // First stage of a batch lookup: the key's home group
+    void PrefetchGroup(size_t hash) const
+    {
+      if (table.numGroups != 0)
+      {
+        __builtin_prefetch(&table.groups[GroupOf(table.numGroups, hash)]);
+      }
+    }
+
+    // Second stage, once that line is in: the first node with the tag
+    void PrefetchNode(size_t hash) const
+    {
+      if (table.numGroups != 0)
+      {
+        const Group &group = table.groups[GroupOf(table.numGroups, hash)];
+        uint32_t bits = Match(group, Tag(hash));
+        if (bits != 0)
+        {
+          __builtin_prefetch(group.slots[__builtin_ctz(bits)]);
+        }
+      }
+    }
+
+    size_t Bytes() const
+    {
+      size_t bytes = table.Bytes() + old.Bytes();
+      for (const Table &t : retired)
+      {
+        bytes += t.Bytes();
+      }
+      return bytes;
+    }
+  };
+
+  // Hierarchical timing wheel over clock ticks. Level L has 64 buckets
+  // of 64^L ticks each; a node sits at the highest level where its expiry
+  // time differs from the wheel's current time, in the bucket for that digit.
+  // When time crosses a bucket boundary the bucket is cascaded one level
+  // down, so every node moves at most kLevels times before it expires.
+  class TimingWheel
+  {
+    public:
+    static constexpr int kExpired = -1;       // Node is in the ready list
+    static constexpr int kOverflow = 0x7f;    // Node is beyond the top level
+
+    private:
+    static constexpr int kBits = 6;
+    static constexpr int kSlots = 1 << kBits;
+
+    // Enough levels to span 2^24 seconds (about 194 days) at the clock's
+    // tick rate: 4 for a seconds clock, 6 for milliseconds
+    static constexpr int LevelsFor(CacheTime ticksPerSecond)
+    {
+      int levels = 1;
+      while ((CacheTime(1) << (kBits * levels)) < (ticksPerSecond << 24))
+      {
+        ++levels;
+      }
+      return levels;
+    }
+    static constexpr int kLevels = LevelsFor(Clock::kTicksPerSecond);
+
+    Node *buckets[kLevels][kSlots] = {};
+    uint64_t occupied[kLevels] = {};
+    Node *overflow = nullptr;
+    Node *expired = nullptr;
+    size_t numScheduled = 0; // Nodes in buckets or overflow
+    CacheTime current = 0;   // Every node with expiryTime < current is in the ready list
+
+    static int Digit(CacheTime t, int level)
+    {
+      return static_cast<int>((t >> (kBits * level)) & (kSlots - 1));
+    }
+
+    static void Link(Node *&head, Node *node)
+    {
+      node->wheelNext = head;
+      node->wheelPprev = &head;
+      if (head != nullptr)
+      {
+        head->wheelPprev = &node->wheelNext;
+      }
+      head = node;
+    }
+
+    void Place(Node *node)
+    {
+      CacheTime e = node->expiryTime;
+      if (e < current)
+      {
+        node->wheelLevel = kExpired;
+        Link(expired, node);
+        return;
+      }
+      ++numScheduled;
+      int level = 0;
+      while (level < kLevels && (e >> (kBits * (level + 1))) != (current >> (kBits * (level + 1))))
+      {
+        ++level;
+      }
+      node->wheelLevel = level;
+      if (level == kLevels)
+      {
+        node->wheelLevel = kOverflow;
+        Link(overflow, node);
+        return;
+      }
+      int slot = Digit(e, level);
+      Link(buckets[level][slot], node);
+      occupied[level] |= uint64_t(1) << slot;
+    }
+
+    // Re-place every node of a bucket against the current time
+    void Cascade(Node *&head)
+    {
+      Node *node = head;
+      head = nullptr;
+      while (node != nullptr)
+      {
+        Node *next = node->wheelNext;
+        --numScheduled;
+        Place(node);
+        node = next;
+      }
+    }
+
+    void CascadeLevel(int level)
+    {
+      int slot = Digit(current, level);
+      occupied[level] &= ~(uint64_t(1) << slot);
+      Cascade(buckets[level][slot]);
+    }
+
+    // Called whenever current lands on a multiple of 64: cascade every level
+    // whose lower digits just rolled over to zero, highest level first so
+    // nodes can fall through several levels in one step.
+    void CrossBoundary()
+    {
+      int top = 0;
+      while (top + 1 < kLevels && Digit(current, top) == 0)
+      {
+        ++top;
+      }
+      if (top == kLevels - 1 && Digit(current, top) == 0)
+      {
+        Cascade(overflow);
+      }
+      for (int level = top; level >= 1; --level)
+      {
+        CascadeLevel(level);
+      }
+    }
+
+    public:
+    void Insert(Node *node)
+    {
+      Place(node);
+    }
+
+    void Erase(Node *node)
+    {
+      *node->wheelPprev = node->wheelNext;
+      if (node->wheelNext != nullptr)
+      {
+        node->wheelNext->wheelPprev = node->wheelPprev;
+      }
+      if (node->wheelLevel == kExpired)
+      {
+        return;
+      }
+      --numScheduled;
+      if (node->wheelLevel != kOverflow)
+      {
+        int slot = Digit(node->expiryTime, node->wheelLevel);
+        if (buckets[node->wheelLevel][slot] == nullptr)
+        {
+          occupied[node->wheelLevel] &= ~(uint64_t(1) << slot);
+        }
+      }
+    }
+
+    // Move every node with expiryTime < now into the ready list. Empty
+    // stretches are skipped with the occupancy bitmaps, so the cost is
+    // proportional to the buckets touched, not to the time elapsed.
+    void Advance(CacheTime now)
+    {
+      while (current < now)
+      {
+        if (numScheduled == 0)
+        {
+          current = now;
+          return;
+        }
+
+        // Earliest tick at which something happens: a level 0 bucket
+        // expires, or a higher level bucket has to be cascaded down.
+        CacheTime next = INT64_MAX;
+        int nextLevel = -1;
+        uint64_t ahead0 = occupied[0] & (~uint64_t(0) << Digit(current, 0));
+        if (ahead0 != 0)
+        {
+          next = (current & ~CacheTime(kSlots - 1)) | __builtin_ctzll(ahead0);
+          nextLevel = 0;
+        }
+        for (int level = 1; level < kLevels && nextLevel < 0; ++level)
+        {
+          int digit = Digit(current, level);
+          uint64_t ahead = digit == kSlots - 1 ? 0 : occupied[level] & (~uint64_t(0) << (digit + 1));
+          if (ahead != 0)
+          {
+            int shift = kBits * (level + 1);
+            next = ((current >> shift) << shift) | (CacheTime(__builtin_ctzll(ahead)) << (kBits * level));
+            nextLevel = level;
+          }
+        }
+        if (nextLevel < 0)
+        {
+          // Only overflow nodes are left: jump to the next top level rollover
+          int shift = kBits * kLevels;
+          next = ((current >> shift) + 1) << shift;
+          nextLevel = kLevels;
+        }
+
+        if (nextLevel == 0)
+        {
+          if (next >= now)
+          {
+            current = now;
+            return;
+          }
+          int slot = Digit(next, 0);
+          occupied[0] &= ~(uint64_t(1) << slot);
+          current = next;
+          Node *node = buckets[0][slot];
+          buckets[0][slot] = nullptr;
+          while (node != nullptr)
+          {
+            Node *nextNode = node->wheelNext;
+            --numScheduled;
+            node->wheelLevel = kExpired;
+            Link(expired, node);
+            node = nextNode;
+          }
+          ++current;
+          if (Digit(current, 0) == 0)
+          {
+            CrossBoundary();
+          }
+        }
+        else
+        {
+          if (next > now)
+          {
+            current = now;
+            return;
+          }
+          current = next;
+          CrossBoundary();
+        }
+      }
+    }
+
+    // A node known to be expired, or nullptr
+    Node *FrontExpired() const
+    {
+      return expired;
+    }
+  };
+
+  public:
+  static constexpr int kMaxDensePriorities = 64 * 64;
+
+  private:
+  int maxItems;
+  size_t maxBytes;
+  size_t totalCharge = 0;
+  ExpiryIndex expiryIndex;
+  Recency recency;
+  Admission admission;
+  double refreshAhead;
+  FrequencySketch sketch; // Sized only with Admission::TinyLFU
+  size_t reapBudget;
+  Clock clock;
+  Stats stats;
+  Listener listener;
+  size_t numItems = 0;
+  NodePool pool;
+  bool deferFree; // ReadMode::LockFree with a trivially copyable Value: removed nodes wait in retired
+  std::vector<std::pair<Node *, EvictReason>> retired;
+
+  SwissIndex index;
+
+  // Dense priorities: one LRU list per priority plus a two-level bitmap of
+  // non-empty lists (bit w of denseSummary set <=> denseWords[w] != 0).
+  int densePriorities;
+  std::vector<LruList> denseLRU;
+  std::vector<uint64_t> denseWords;
+  uint64_t denseSummary = 0;
+
+  // Sparse priorities, for anything outside the dense range
+  std::set<int> priorityQueue;                    // Store only the priority numbers
+  std::unordered_map<int, LruList> priorityLRU;   // LRU tracking for each priority
+
+  // Binary min-heap on expiryTime. Every node knows its own slot, so an
+  // arbitrary node can be removed or re-keyed in O(log n) without a search.
+  BlockArray expiryHeap;
+  TimingWheel expiryWheel;
+
+  static size_t HashOf(const Node *node)
+  {
+    if constexpr (kStoreHash)
+    {
+      return node->hash;
+    }
+    else
+    {
+      return Hash()(node->key);
+    }
+  }
+
+  Node *FindNode(KeyView key, size_t hash) const
+  {
+    return index.Find(hash, [&](const Node *node) {
+      if constexpr (kStoreHash)
+      {
+        if (node->hash != hash)
+        {
+          return false;
+        }
+      }
+      return node->key == key;
+    });
+  }
+
+  void HashInsert(Node *node)
+  {
+    index.Insert(node, HashOf(node));
+  }
+
+  void HashErase(Node *node)
+  {
+    index.Erase(node, HashOf(node));
+  }
+
+  void HeapSwap(size_t a, size_t b)
+  {
+    std::swap(expiryHeap[a], expiryHeap[b]);
+    expiryHeap[a]->expiryPos = static_cast<uint32_t>(a);
+    expiryHeap[b]->expiryPos = static_cast<uint32_t>(b);
+  }
+
+  void HeapSiftUp(size_t pos)
+  {
+    while (pos > 0)
+    {
+      size_t parent = (pos - 1) / 2;
+      if (expiryHeap[parent]->expiryTime <= expiryHeap[pos]->expiryTime)
+      {
+        break;
+      }
+      HeapSwap(pos, parent);
+      pos = parent;
+    }
+  }
+
+  void HeapSiftDown(size_t pos)
+  {
+    size_t n = expiryHeap.size();
+    while (true)
+    {
+      size_t smallest = pos;
+      size_t left = 2 * pos + 1;
+      size_t right = left + 1;
+      if (left < n && expiryHeap[left]->expiryTime < expiryHeap[smallest]->expiryTime)
+      {
+        smallest = left;
+      }
+      if (right < n && expiryHeap[right]->expiryTime < expiryHeap[smallest]->expiryTime)
+      {
+        smallest = right;
+      }
+      if (smallest == pos)
+      {
+        break;
+      }
+      HeapSwap(pos, smallest);
+      pos = smallest;
+    }
+  }
+
+  void HeapPush(Node *node)
+  {
+    node->expiryPos = static_cast<uint32_t>(expiryHeap.size());
+    expiryHeap.push_back(node);
+    HeapSiftUp(node->expiryPos);
+  }
+
+  void HeapErase(Node *node)
+  {
+    size_t pos = node->expiryPos;
+    HeapSwap(pos, expiryHeap.size() - 1);
+    expiryHeap.pop_back();
+    if (pos < expiryHeap.size())
+    {
+      HeapSiftUp(pos);
+      HeapSiftDown(expiryHeap[pos]->expiryPos);
+    }
+  }
+
+  void ExpiryInsert(Node *node)
+  {
+    if (expiryIndex == ExpiryIndex::TimingWheel)
+    {
+      expiryWheel.Insert(node);
+    }
+    else
+    {
+      HeapPush(node);
+    }
+  }
+
+  void ExpiryErase(Node *node)
+  {
+    if (expiryIndex == ExpiryIndex::TimingWheel)
+    {
+      expiryWheel.Erase(node);
+    }
+    else
+    {
+      HeapErase(node);
+    }
+  }
+
+  // Give a node a new expiryTime and re-position it. The wheel has to find
+  // the node's bucket from the old time, so the update happens in here.
+  void ExpiryUpdate(Node *node, CacheTime expiryTime)
+  {
+    if (expiryTime == node->expiryTime)
+    {
+      return;
+    }
+    if (expiryIndex == ExpiryIndex::TimingWheel)
+    {
+      expiryWheel.Erase(node);
+      node->expiryTime = expiryTime;
+      expiryWheel.Insert(node);
+    }
+    else
+    {
+      node->expiryTime = expiryTime;
+      HeapSiftUp(node->expiryPos);
+      HeapSiftDown(node->expiryPos);
+    }
+  }
+
+  // Some expired node, or nullptr if nothing has expired
+  Node *NextExpired()
+  {
+    if (expiryIndex == ExpiryIndex::TimingWheel)
+    {
+      expiryWheel.Advance(clock.Now());
+      return expiryWheel.FrontExpired();
+    }
+    if (!expiryHeap.empty() && expiryHeap.front()->isExpired(clock.Now()))
+    {
+      return expiryHeap.front();
+    }
+    return nullptr;
+  }
+
+  bool IsDense(int priority) const
+  {
+    return priority >= 0 && priority < densePriorities;
+  }
+
+  LruList &ListFor(int priority)
+  {
+    return IsDense(priority) ? denseLRU[priority] : priorityLRU[priority];
+  }
+
+  void LinkLRU(Node *node)
+  {
+    int priority = node->priority;
+    LruList &lruList = ListFor(priority);
+    if (lruList.empty())
+    {
+      if (IsDense(priority))
+      {
+        denseWords[priority / 64] |= uint64_t(1) << (priority % 64);
+        denseSummary |= uint64_t(1) << (priority / 64);
+      }
+      else
+      {
+        priorityQueue.insert(priority);
+      }
+    }
+    lruList.PushFront(node);
+  }
+
+  void UnlinkLRU(Node *node)
+  {
+    int priority = node->priority;
+    LruList &lruList = ListFor(priority);
+    lruList.Unlink(node);
+    // If all items for this priority have been removed, delete the priority from the queue.
+    // The empty list head stays in priorityLRU so the priority can come back without rehashing.
+    if (lruList.empty())
+    {
+      if (IsDense(priority))
+      {
+        uint64_t &word = denseWords[priority / 64];
+        word &= ~(uint64_t(1) << (priority % 64));
+        if (word == 0)
+        {
+          denseSummary &= ~(uint64_t(1) << (priority / 64));
+        }
+      }
+      else
+      {
+        priorityQueue.erase(priority);
+      }
+    }
+  }
+
+  // The non-empty LRU list with the lowest priority, or nullptr if empty.
+  // Sparse priorities below 0 beat every dense one; those at or above
+  // densePriorities lose to any dense one.
+  const LruList *LowestPriorityList(int &priority) const
+  {
+    if (!priorityQueue.empty() && (*priorityQueue.begin() < 0 || denseSummary == 0))
+    {
+      priority = *priorityQueue.begin();
+      return &priorityLRU.find(priority)->second;
+    }
+    if (denseSummary == 0)
+    {
+      return nullptr;
+    }
+    int word = __builtin_ctzll(denseSummary);
+    priority = word * 64 + __builtin_ctzll(denseWords[word]);
+    return &denseLRU[priority];
+  }
+
+  // Unlink a node from every index, report it and return its slot to the pool
+  void RemoveNode(Node *node, EvictReason reason)
+  {
+    HashErase(node);
+    UnlinkLRU(node);
+    ExpiryErase(node);
+    totalCharge -= node->charge;
+    stats.RecordEviction(reason);
+    --numItems;
+    if (deferFree)
+    {
+      node->retired = true; // A lock-free reader may still hold it
+      retired.emplace_back(node, reason);
+      return;
+    }
+    DestroyNode(node, reason);
+  }
+
+  // Remove an entry whose value was already destroyed, as Emplace leaves
+  // it when the new value's constructor throws. Such values are not
+  // trivially copyable, so the node is never deferred for lock-free readers.
+  void DropValueless(Node *node)
+  {
+    HashErase(node);
+    UnlinkLRU(node);
+    ExpiryErase(node);
+    totalCharge -= node->charge;
+    stats.RecordEviction(EvictReason::Explicit);
+    --numItems;
+    node->key.~Key();
+    pool.Free(node);
+  }
+
+  // Hand the entry to the listener and give the slot back to the pool
+  void DestroyNode(Node *node, EvictReason reason)
+  {
+    if constexpr (Listener::kEnabled)
+    {
+      listener.OnEviction(std::move(node->key), std::move(node->value), node->priority, node->expiryTime, reason);
+    }
+    node->~Node();
+    pool.Free(node);
+  }
+
+  // The bookkeeping for a Get hit
+  void RecordUse(Node *node, CacheTime now)
+  {
+    if (recency == Recency::Clock)
+    {
+      // Mark it and leave the list alone; a hot entry is written only once
+      if (!node->referenced)
+      {
+        node->referenced = true;
+      }
+      return;
+    }
+
+    // Update last access time to reflect recent usage (LRU)
+    node->lastAccessTime = now;
+
+    // Move the node to the front of the LRU list for its priority
+    LruList &lruList = ListFor(node->priority);
+    lruList.Unlink(node);
+    lruList.PushFront(node);
+  }
+
+  template <typename Fn>
+  static void ForEachNodeInList(const LruList &lruList, Fn &fn)
+  {
+    for (Node *node = lruList.head; node != nullptr;)
+    {
+      Node *next = node->lruNext;
+      fn(node);
+      node = next;
+    }
+  }
+
+  template <typename Fn>
+  void ForEachNode(Fn fn) const
+  {
+    for (const LruList &lruList : denseLRU)
+    {
+      ForEachNodeInList(lruList, fn);
+    }
+    for (const auto &entry : priorityLRU)
+    {
+      ForEachNodeInList(entry.second, fn);
+    }
+  }
+
+  public:
+  // Constructor
+  BasicPriorityExpiryCache(int maxItems, const CacheOptions &options = CacheOptions(), const Clock &clock = Clock(),
+                           const Listener &listener = Listener())
+      : maxItems(maxItems), maxBytes(options.maxBytes), expiryIndex(options.expiryIndex), recency(options.recency),
+        admission(options.admission), refreshAhead(options.refreshAhead), reapBudget(options.reapBudget),
+        clock(clock), stats(), listener(listener),
+        deferFree(options.readMode == ReadMode::LockFree && std::is_trivially_copyable<Value>::value),
+        densePriorities(std::min(std::max(options.densePriorities, 0), static_cast<int>(kMaxDensePriorities))),
+        denseLRU(densePriorities), denseWords((densePriorities + 63) / 64, 0)
+  {
+    ResizeSketch();
+    index.DeferFree(deferFree);
+  }
+
+  ~BasicPriorityExpiryCache()
+  {
+    FreeRetired(Retired());
+    ForEachNode([](Node *node) { node->~Node(); });
+  }
+
+  BasicPriorityExpiryCache(const BasicPriorityExpiryCache &) = delete;
+  BasicPriorityExpiryCache &operator=(const BasicPriorityExpiryCache &) = delete;
+
+  // The hash every lookup uses. Callers that already hold it can pass it to
+  // the Get/Set overloads below; it must be HashKey(key) for the same key.
+  static size_t HashKey(KeyView key)
+  {
+    return Hash()(key);
+  }
+
+  // The cache's own time source, e.g. to advance a ManualClock
+  Clock &GetClock()
+  {
+    return clock;
+  }
+
+  // Latency histograms and eviction counters, when Stats records them
+  Stats &GetStats()
+  {
+    return stats;
+  }
+
+  Listener &GetListener()
+  {
+    return listener;
+  }
+
+  // Get the value of the key if it exists and is not expired. The pointer
+  // is only good until the next call on the cache: a write may evict the
+  // entry, and even a Get may reclaim it once it has expired.
+  Value *Get(KeyView key)
+  {
+    return Get(key, HashKey(key));
+  }
+
+  // Same as Get(key), with the key hash already computed
+  Value *Get(KeyView key, size_t hash)
+  {
+    return Lookup(key, hash, nullptr, clock.Now());
+  }
+
+  // What a hit tells the caller about CacheOptions::refreshAhead: whether
+  // this caller should reload the entry, which version of it it saw, and
+  // how to write it again
+  struct Refresh
+  {
+    bool due = false;
+    const void *entry = nullptr;
+    CacheTime expiryTime = 0;
+    int priority = 0;
+    CacheTime ttl = 0;
+  };
+
+  // Same as Get(key, hash), also filling in refresh on a hit. Only the
+  // first hit in the refresh window gets due, and only through a call that
+  // asks for it; the reload goes back in through FinishRefresh.
+  Value *Get(KeyView key, size_t hash, Refresh &refresh)
+  {
+    return Lookup(key, hash, &refresh, clock.Now());
+  }
+
+  private:
+  // Get, claiming a due refresh when the caller takes it
+  Value *Lookup(KeyView key, size_t hash, Refresh *refresh, CacheTime now)
+  {
+    uint64_t start = StatsNow();
+    if (admission == Admission::TinyLFU)
+    {
+      sketch.Increment(hash); // Misses count too: a key asked for often deserves a slot
+    }
+    Node *node = FindNode(key, hash);
+    if (node == nullptr)
+    {
+      RecordLatency(CacheOp::GetMiss, start);
+      return nullptr; // Cache miss
+    }
+    if (node->isExpired(now))
+    {
+      RemoveNode(node, EvictReason::Expired); // Reclaim it now rather than on some later eviction pass
+      RecordLatency(CacheOp::GetMiss, start);
+      return nullptr;
+    }
+
+    RecordUse(node, now);
+    if (refresh != nullptr)
+    {
+      CheckRefresh(node, now, *refresh);
+      if (refresh->due)
+      {
+        refresh->due = ClaimRefresh(node);
+      }
+    }
+    RecordLatency(CacheOp::GetHit, start);
+    return &node->value;
+  }
+
+  // Whether a hit is inside the refresh-ahead window and nobody has
+  // claimed the reload yet; the flag is only read, so this is cheap for
+  // every later hit in the window
+  void CheckRefresh(const Node *node, CacheTime now, Refresh &refresh) const
+  {
+    if (refreshAhead > 0 && node->expiryTime - now <= static_cast<CacheTime>(node->ttl * refreshAhead) &&
+        !node->refreshing.load(std::memory_order_relaxed))
+    {
+      refresh.due = true;
+      refresh.entry = node;
+      refresh.expiryTime = node->expiryTime;
+      refresh.priority = node->priority;
+      refresh.ttl = node->ttl;
+    }
+  }
+
+  public:
+  // Claim the reload of an entry CheckRefresh found due; true for exactly
+  // one caller until the entry is written again. Lock-free readers call it
+  // after their read proved consistent, while the entry cannot be freed.
+  bool ClaimRefresh(const void *entry)
+  {
+    const Node *node = static_cast<const Node *>(entry);
+    return !const_cast<Node *>(node)->refreshing.exchange(true);
+  }
+
+  // Store a claimed reload with the priority and TTL the entry had. A
+  // newer write to the entry wins over the loaded value. An entry that is
+  // gone (it expired and was reclaimed while a slow load ran, or was
+  // evicted) is stored again, so the caller must drop the result itself
+  // if it removed or wrote the key meanwhile. Returns whether it was stored.
+  bool FinishRefresh(KeyView key, size_t hash, const Value &value, const Refresh &refresh)
+  {
+    Node *node = FindNode(key, hash);
+    if (node != nullptr && (node != refresh.entry || node->expiryTime != refresh.expiryTime ||
+                            !node->refreshing.load(std::memory_order_relaxed)))
+    {
+      return false;
+    }
+    SetUntil(key, hash, value, refresh.priority, clock.Now() + refresh.ttl);
+    return true;
+  }
+
+  // ReadMode::LockFree support for the sharded cache, which serializes the
+  // writers and tells the readers when to retry.
+  //
+  // Look the key up while a writer may be changing the cache. stable()
+  // must say whether a write may have overlapped the reads so far; the
+  // answer is garbage unless the caller's own check after the call
+  // passes. Nothing is recorded: the caller queues the entry it gets back
+  // (nullptr on a miss) for ReplayGet(), and a due refresh still has to
+  // be claimed with ClaimRefresh().
+  template <typename Stable>
+  bool ReadConcurrent(KeyView key, size_t hash, Value &value, const void *&entry, Refresh &refresh,
+                      Stable stable) const
+  {
+    static_assert(std::is_trivially_copyable<Value>::value, "a torn copy must be harmless to throw away");
+    const Node *node = index.FindConcurrent(hash, [&](const Node *node) {
+      if constexpr (kStoreHash)
+      {
+        if (node->hash != hash)
+        {
+          return false;
+        }
+      }
+      return node->key == key;
+    }, stable);
+    entry = node;
+    CacheTime now = clock.Now();
+    if (node == nullptr || node->isExpired(now))
+    {
+      return false;
+    }
+    value = node->value;
+    CheckRefresh(node, now, refresh);
+    return true;
+  }
+
+  // Whether lock-free misses are worth queueing too (they feed the sketch)
+  bool CountsMisses() const
+  {
+    return admission == Admission::TinyLFU;
+  }
+
+  // Replay a lock-free Get: a count in the admission sketch and the usual
+  // hit bookkeeping for the entry, unless it has been removed since. The
+  // caller must not have freed the entry (FreeRetired) in between.
+  void ReplayGet(const void *entry, size_t hash)
+  {
+    if (admission == Admission::TinyLFU)
+    {
+      sketch.Increment(hash);
+    }
+    Node *node = static_cast<Node *>(const_cast<void *>(entry));
+    CacheTime now = clock.Now();
+    if (node != nullptr && !node->retired && !node->isExpired(now))
+    {
+      RecordUse(node, now);
+    }
+  }
+
+  // Nodes and index tables removed so far whose memory is still held
+  struct RetiredCounts
+  {
+    size_t nodes;
+    size_t tables;
+  };
+
+  RetiredCounts Retired() const
+  {
+    return {retired.size(), index.RetiredTables()};
+  }
+
+  // Really free the oldest upTo of them, once no reader can reach them
+  void FreeRetired(RetiredCounts upTo)
+  {
+    for (size_t i = 0; i < upTo.nodes; ++i)
+    {
+      DestroyNode(retired[i].first, retired[i].second);
+    }
+    retired.erase(retired.begin(), retired.begin() + upTo.nodes);
+    index.FreeRetired(upTo.tables);
+  }
+
+  // Set the key-value pair with priority and expiry time
+  void Set(KeyView key, const Value &value, int priority, int expiryInSecs)
+  {
+    Set(key, HashKey(key), value, priority, expiryInSecs);
+  }
+
+  // Same as Set(key, ...), with the key hash already computed. The key is
+  // only copied when a new node is created.
+  void Set(KeyView key, size_t hash, const Value &value, int priority, int expiryInSecs)
+  {
+    uint64_t start = StatsNow();
+    CacheTime now = clock.Now();
+    bool inserted = Upsert(key, hash, value, priority, Deadline(now, expiryInSecs), now);
+    EvictAfterWrite(); // Evict if needed after adding new item
+    RecordLatency(inserted ? CacheOp::SetInsert : CacheOp::SetUpdate, start);
+  }
+
+  // Move overloads: the value is moved into a new node, or move-assigned
+  // over the old value when the key already exists
+  void Set(KeyView key, Value &&value, int priority, int expiryInSecs)
+  {
+    Set(key, HashKey(key), std::move(value), priority, expiryInSecs);
+  }
+
+  void Set(KeyView key, size_t hash, Value &&value, int priority, int expiryInSecs)
+  {
+    uint64_t start = StatsNow();
+    CacheTime now = clock.Now();
+    bool inserted = Upsert(key, hash, std::move(value), priority, Deadline(now, expiryInSecs), now);
+    EvictAfterWrite();
+    RecordLatency(inserted ? CacheOp::SetInsert : CacheOp::SetUpdate, start);
+  }
+
+  // Absolute expiry time of an entry set now with a TTL in whole seconds
+  static CacheTime Deadline(CacheTime now, int expiryInSecs)
+  {
+    return now + CacheTime(expiryInSecs) * Clock::kTicksPerSecond;
+  }
+
+  // Set with an absolute expiry time in clock ticks rather than a TTL, for
+  // entries that carry their deadline with them (snapshots, a lower tier)
+  void SetUntil(KeyView key, const Value &value, int priority, CacheTime expiryTime)
+  {
+    SetUntil(key, HashKey(key), value, priority, expiryTime);
+  }
+
+  void SetUntil(KeyView key, size_t hash, const Value &value, int priority, CacheTime expiryTime)
+  {
+    uint64_t start = StatsNow();
+    bool inserted = Upsert(key, hash, value, priority, expiryTime, clock.Now());
+    EvictAfterWrite();
+    RecordLatency(inserted ? CacheOp::SetInsert : CacheOp::SetUpdate, start);
+  }
+
+  // Construct the value from args directly inside the entry's node. If the
+  // key exists its old value is destroyed and the new one is constructed in
+  // the same node, so args must not refer to the old value. If that
+  // constructor throws, the exception propagates and the key is gone: it
+  // counts as an explicit removal, and the listener has seen the old value
+  // as Replaced. A trivially copyable value is built aside first instead,
+  // so there the entry is left as it was.
+  template <typename... Args>
+  void Emplace(KeyView key, int priority, int expiryInSecs, Args &&...args)
+  {
+    uint64_t start = StatsNow();
+    size_t hash = HashKey(key);
+    CacheTime now = clock.Now();
+    Node *node = FindNode(key, hash);
+    if (node != nullptr)
+    {
+      if (admission == Admission::TinyLFU)
+      {
+        sketch.Increment(hash);
+      }
+      if constexpr (std::is_trivially_copyable<Value>::value)
+      {
+        Value value(std::forward<Args>(args)...);
+        ReportReplaced(node);
+        node->value.~Value();
+        new (&node->value) Value(value);
+      }
+      else
+      {
+        ReportReplaced(node);
+        node->value.~Value();
+        try
+        {
+          new (&node->value) Value(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+          DropValueless(node);
+          throw;
+        }
+      }
+      Charge(node);
+      Relink(node, priority, Deadline(now, expiryInSecs), now);
+    }
+    else if (Admit(hash, priority))
+    {
+      Insert(new (pool.Allocate()) Node(key, hash, std::forward<Args>(args)...), priority, Deadline(now, expiryInSecs), now);
+    }
+    else
+    {
+      stats.RecordEviction(EvictReason::Rejected);
+      if constexpr (Listener::kEnabled)
+      {
+        listener.OnEviction(Key(key), Value(std::forward<Args>(args)...), priority, Deadline(now, expiryInSecs),
+                            EvictReason::Rejected);
+      }
+    }
+    EvictAfterWrite();
+    RecordLatency(node == nullptr ? CacheOp::SetInsert : CacheOp::SetUpdate, start);
+  }
+
+  // Look up a batch of keys. values[i] receives what Get(keys[i]) would
+  // return, and like Get's pointer it is only good until the next call on
+  // the cache, Get and MultiGet included, since any lookup may reclaim an
+  // expired entry; copy out what has to live longer. The whole batch is
+  // read at one clock time, so a key repeated in it cannot expire between
+  // its lookups and free what an earlier slot points to.
+  void MultiGet(const KeyView *keys, size_t count, Value **values)
+  {
+    batchHashes.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+      batchHashes[i] = HashKey(keys[i]);
+    }
+    MultiGet(keys, batchHashes.data(), count, values);
+  }
+
+  // Same as MultiGet(keys, count, values), with hashes[i] == HashKey(keys[i]).
+  // With refreshes, refreshes[i] is filled in as by Get(key, hash, refresh).
+  void MultiGet(const KeyView *keys, const size_t *hashes, size_t count, Value **values,
+                Refresh *refreshes = nullptr)
+  {
+    CacheTime now = clock.Now();
+    ForEachPrefetched(hashes, count, [&](size_t i) {
+      values[i] = Lookup(keys[i], hashes[i], refreshes != nullptr ? &refreshes[i] : nullptr, now);
+    });
+  }
+
+  // Apply a batch of writes, then evict once for the whole batch. The
+  // cache may hold up to maxItems + count entries while the batch is being
+  // applied, but never more than maxItems once MultiSet returns.
+  void MultiSet(const Write *writes, size_t count)
+  {
+    batchHashes.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+      batchHashes[i] = HashKey(writes[i].key);
+    }
+    MultiSet(writes, batchHashes.data(), count);
+  }
+
+  // Same as MultiSet(writes, count), with hashes[i] == HashKey(writes[i].key)
+  void MultiSet(const Write *writes, const size_t *hashes, size_t count)
+  {
+    CacheTime now = clock.Now();
+    ForEachPrefetched(hashes, count, [&](size_t i) {
+      const Write &write = writes[i];
+      uint64_t start = StatsNow();
+      bool inserted = Upsert(write.key, hashes[i], write.value, write.priority, Deadline(now, write.expiryInSecs), now);
+      RecordLatency(inserted ? CacheOp::SetInsert : CacheOp::SetUpdate, start);
+    });
+    EvictAfterWrite();
+  }
+
+  private:
+  // Scratch space for the batch APIs, kept to avoid reallocating per call
+  std::vector<size_t> batchHashes;
+
+  // Snapshot file layout: one header, then per entry a record, the value's
+  // bytes and the key's bytes, unaligned and in the host's byte order
+  struct SnapshotHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t valueSize;
+    uint32_t keySize; // 0 for variable-length (string) keys
+    uint32_t ticksPerSecond;
+    uint64_t count;
+  };
+
+  struct SnapshotRecord
+  {
+    int64_t expiryTime;
+    int64_t lastAccessTime;
+    int32_t priority;
+    uint32_t keyLength;
+  };
+
+  static constexpr size_t kSnapshotBufferBytes = 1 << 20;
+
+  static SnapshotHeader MakeSnapshotHeader(uint64_t count)
+  {
+    SnapshotHeader header;
+    memcpy(header.magic, "PECSNAP1", sizeof(header.magic));
+    header.version = 2;
+    header.valueSize = sizeof(Value);
+    header.keySize = std::is_same<Key, std::string>::value ? 0 : sizeof(Key);
+    header.ticksPerSecond = Clock::kTicksPerSecond;
+    header.count = count;
+    return header;
+  }
+
+  // How many keys ahead of the one being processed the batch loop prefetches
+  static constexpr size_t kPrefetchDistance = 8;
+
+  // Software pipeline over a batch of hashes: prefetch the index group of
+  // key i + 2D, then (once those lines have arrived) the first node whose
+  // tag matches key i + D, and only then run fn(i), so the misses of
+  // several keys overlap.
+  template <typename Fn>
+  void ForEachPrefetched(const size_t *hashes, size_t count, Fn fn)
+  {
+    const size_t d = kPrefetchDistance;
+    for (size_t i = 0; i < count + 2 * d; ++i)
+    {
+      if (i < count)
+      {
+        index.PrefetchGroup(hashes[i]);
+      }
+      if (i >= d && i - d < count)
+      {
+        index.PrefetchNode(hashes[i - d]);
+      }
+      if (i >= 2 * d)
+      {
+        fn(i - 2 * d);
+      }
+    }
+  }
+
+  // Insert or update one entry without evicting. V is const Value & or
+  // Value, so the value is copied or moved exactly once either way.
+  // Returns true if the key was new, whether or not it was admitted.
+  template <typename V>
+  bool Upsert(KeyView key, size_t hash, V &&value, int priority, CacheTime expiryTime, CacheTime now)
+  {
+    Node *node = FindNode(key, hash);
+    if (node != nullptr) // Update the existing node in place
+    {
+      if (admission == Admission::TinyLFU)
+      {
+        sketch.Increment(hash);
+      }
+      ReportReplaced(node);
+      node->value = std::forward<V>(value);
+      Charge(node);
+      Relink(node, priority, expiryTime, now);
+      return false;
+    }
+    if (Admit(hash, priority))
+    {
+      Insert(new (pool.Allocate()) Node(key, hash, std::forward<V>(value)), priority, expiryTime, now);
+    }
+    else
+    {
+      ReportRejected(key, std::forward<V>(value), priority, expiryTime);
+    }
+    return true;
+  }
+
+  // Admission filter for a new key, which is counted in the sketch first.
+  // Only a full cache with nothing expired filters: the candidate is then
+  // compared with the entry eviction would take, the LRU tail of the lowest
+  // priority. A higher-priority candidate always gets in and a lower one is
+  // let in to be evicted right away, as before; only a tie in priority is
+  // settled by frequency, and the resident wins a tie in frequency.
+  bool Admit(size_t hash, int priority)
+  {
+    if (admission != Admission::TinyLFU)
+    {
+      return true;
+    }
+    sketch.Increment(hash);
+    bool full = numItems >= static_cast<size_t>(std::max(maxItems, 0)) ||
+                (maxBytes != 0 && totalCharge + kEntryOverhead > maxBytes);
+    if (!full || NextExpired() != nullptr)
+    {
+      return true;
+    }
+    int lowest;
+    const LruList *lruList = LowestPriorityList(lowest);
+    if (lruList == nullptr || lowest != priority || sketch.Frequency(hash) > sketch.Frequency(HashOf(lruList->tail)))
+    {
+      return true;
+    }
+    return false;
+  }
+
+  // A rejected write is counted and handed to the listener like an
+  // eviction, so a write-behind sink still gets the value
+  template <typename V>
+  void ReportRejected(KeyView key, V &&value, int priority, CacheTime expiryTime)
+  {
+    stats.RecordEviction(EvictReason::Rejected);
+    if constexpr (Listener::kEnabled)
+    {
+      listener.OnEviction(Key(key), Value(std::forward<V>(value)), priority, expiryTime, EvictReason::Rejected);
+    }
+  }
+
+  // The old value is about to be overwritten. A listener gets it moved out
+  // (and a copy of the key), so it must not be read again before the write.
+  void ReportReplaced(Node *node)
+  {
+    stats.RecordEviction(EvictReason::Replaced);
+    if constexpr (Listener::kEnabled)
+    {
+      listener.OnEviction(Key(node->key), std::move(node->value), node->priority, node->expiryTime, EvictReason::Replaced);
+    }
+  }
+
+  void ResizeSketch()
+  {
+    if (admission == Admission::TinyLFU)
+    {
+      sketch.Resize(static_cast<size_t>(std::max(maxItems, 0)));
+    }
+  }
+
+  // Monotonic nanoseconds for the latency stats, or 0 without reading the
+  // clock when the Stats policy records nothing
+  static uint64_t StatsNow()
+  {
+    if constexpr (Stats::kEnabled)
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    return 0;
+  }
+
+  void RecordLatency(CacheOp op, uint64_t start)
+  {
+    if constexpr (Stats::kEnabled)
+    {
+      stats.RecordLatency(op, StatsNow() - start);
+    }
+  }
+
+  // Link a freshly constructed node into every index
+  void Insert(Node *node, int priority, CacheTime expiryTime, CacheTime now)
+  {
+    node->priority = priority;
+    node->expiryTime = expiryTime;
+    node->ttl = TtlTicks(expiryTime, now);
+    node->lastAccessTime = now;
+    HashInsert(node);
+    LinkLRU(node);
+    ExpiryInsert(node);
+    Charge(node);
+    ++numItems;
+  }
+
+  // What every entry costs besides the Weigher's bytes: its node, plus
+  // about one index slot and one expiry heap slot
+  static constexpr size_t kEntryOverhead = sizeof(Node) + 2 * sizeof(Node *);
+
+  // (Re)compute the node's charge after its value was set; O(1), the
+  // running total is adjusted by the difference
+  void Charge(Node *node)
+  {
+    size_t charge = std::min<size_t>(kEntryOverhead + Weigher()(node->key, node->value), UINT32_MAX);
+    totalCharge = totalCharge - node->charge + charge;
+    node->charge = static_cast<uint32_t>(charge);
+  }
+
+  // An existing key was written again: keep the node and its hash chain
+  // position, and only touch the LRU and expiry structures that changed
+  void Relink(Node *node, int priority, CacheTime expiryTime, CacheTime now)
+  {
+    node->referenced = false; // Moving to the front is this write's second chance
+    if (priority == node->priority)
+    {
+      LruList &lruList = ListFor(priority);
+      lruList.Unlink(node);
+      lruList.PushFront(node);
+    }
+    else
+    {
+      UnlinkLRU(node);
+      node->priority = priority;
+      LinkLRU(node);
+    }
+    node->lastAccessTime = now;
+    node->ttl = TtlTicks(expiryTime, now);
+    node->refreshing.store(false, std::memory_order_relaxed); // A reload still running is stale now
+    ExpiryUpdate(node, expiryTime);
+  }
+
+  static uint32_t TtlTicks(CacheTime expiryTime, CacheTime now)
+  {
+    return static_cast<uint32_t>(std::min<CacheTime>(std::max<CacheTime>(expiryTime - now, 0), UINT32_MAX));
+  }
+
+  public:
+  // Set the max cache size and evict items accordingly
+  void SetMaxItems(int numItems)
+  {
+    maxItems = numItems;
+    ResizeSketch();
+    EvictItems();
+  }
+
+  // Set the byte budget (0 for none) and evict accordingly
+  void SetMaxBytes(size_t bytes)
+  {
+    maxBytes = bytes;
+    EvictItems();
+  }
+
+  // Evict expired items and low-priority items if the cache exceeds max size
+  void EvictItems()
+  {
+    uint64_t start = StatsNow();
+
+    // Evict expired items first
+    ReapExpired(SIZE_MAX);
+
+    // Evict least recently used items of the lowest priority while over maxItems or maxBytes
+    EvictToCapacity();
+
+    RecordLatency(CacheOp::EvictItems, start);
+  }
+
+  // Remove at most budget expired entries and return how many went. Lets a
+  // background thread or the request loop reclaim expired memory in small
+  // steps with a bounded pause per call.
+  size_t ReapExpired(size_t budget)
+  {
+    size_t reaped = 0;
+    while (reaped < budget)
+    {
+      Node *expired = NextExpired();
+      if (expired == nullptr)
+      {
+        break;
+      }
+      RemoveNode(expired, EvictReason::Expired);
+      ++reaped;
+    }
+    return reaped;
+  }
+
+  private:
+  // Eviction after Set/Emplace/MultiSet: with a reap budget, reclaim at
+  // most that many expired entries up front, then make room one entry at a
+  // time, still preferring an expired entry over a live one.
+  void EvictAfterWrite()
+  {
+    if (reapBudget == 0)
+    {
+      EvictItems();
+      return;
+    }
+    uint64_t start = StatsNow();
+    ReapExpired(reapBudget);
+    EvictToCapacity();
+    RecordLatency(CacheOp::EvictItems, start);
+  }
+
+  bool OverCapacity() const
+  {
+    return numItems > static_cast<size_t>(std::max(maxItems, 0)) || (maxBytes != 0 && totalCharge > maxBytes);
+  }
+
+  // An entry charged more than maxBytes on its own ends up evicting itself
+  void EvictToCapacity()
+  {
+    while (OverCapacity())
+    {
+      Node *expired = NextExpired();
+      if (expired != nullptr)
+      {
+        RemoveNode(expired, EvictReason::Expired);
+      }
+      else
+      {
+        EvictLowest();
+      }
+    }
+  }
+
+  public:
+  // Number of entries currently resident, expired or not
+  size_t Size() const
+  {
+    return numItems;
+  }
+
+  // Sum of the entries' charges, what maxBytes is compared against
+  size_t TotalCharge() const
+  {
+    return totalCharge;
+  }
+
+  // Bytes held by the pool, the hash index, the expiry heap, the
+  // per-priority lists and any key characters that did not fit inline.
+  size_t MemoryUsage() const
+  {
+    size_t bytes = pool.BytesReserved();
+    bytes += index.Bytes();
+    bytes += expiryHeap.capacity() * sizeof(Node *);
+    bytes += denseLRU.capacity() * sizeof(LruList) + denseWords.capacity() * sizeof(uint64_t);
+    bytes += priorityLRU.size() * (sizeof(int) + sizeof(LruList) + 2 * sizeof(void *));
+    bytes += priorityQueue.size() * (sizeof(int) + 4 * sizeof(void *));
+    bytes += sketch.Bytes();
+    ForEachNode([&bytes](Node *node) { bytes += KeyTraits<Key>::HeapBytes(node->key); });
+    return bytes;
+  }
+
+  // The part of MemoryUsage() that is mapped directly rather than taken
+  // from operator new: the hash index tables
+  size_t MappedBytes() const
+  {
+    return index.Bytes();
+  }
+
+  // Whether the key has a live entry, without counting as a use
+  bool Contains(KeyView key) const
+  {
+    const Node *node = FindNode(key, HashKey(key));
+    return node != nullptr && !node->isExpired(clock.Now());
+  }
+
+  // Remove every entry, each reported as EvictReason::Explicit
+  void Clear()
+  {
+    ForEachNode([this](Node *node) { RemoveNode(node, EvictReason::Explicit); });
+    index.Clear(); // Drop the overflow bits the erased nodes left
+  }
+
+  // Remove one key. Returns true if it held a live entry; an expired one is
+  // still removed, but reported as EvictReason::Expired.
+  bool Remove(KeyView key)
+  {
+    return Remove(key, HashKey(key));
+  }
+
+  bool Remove(KeyView key, size_t hash)
+  {
+    Node *node = FindNode(key, hash);
+    if (node == nullptr)
+    {
+      return false;
+    }
+    bool live = !node->isExpired(clock.Now());
+    RemoveNode(node, live ? EvictReason::Explicit : EvictReason::Expired);
+    return live;
+  }
+
+  // Write every entry to path: per priority, least to most recently used,
+  // so LoadSnapshot rebuilds the same LRU order. Expiry and access times
+  // are absolute clock times, so the snapshot only means something to a
+  // cache on the same clock (CoarseClock's holds until reboot). The file
+  // is written as path.tmp and renamed over path, so a crash never leaves
+  // a torn snapshot behind.
+  bool SaveSnapshot(const char *path) const
+  {
+    static_assert(KeyTraits<Key>::kSnapshot && std::is_trivially_copyable<Value>::value,
+                  "snapshots need a std::string or trivially copyable key and a trivially copyable value");
+    std::string tmpPath = std::string(path) + ".tmp";
+    FILE *file = fopen(tmpPath.c_str(), "wb");
+    if (file == nullptr)
+    {
+      return false;
+    }
+
+    bool ok = true;
+    std::vector<char> buffer;
+    buffer.reserve(kSnapshotBufferBytes);
+    auto flush = [&]() {
+      ok = ok && fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+      buffer.clear();
+    };
+    auto append = [&](const void *data, size_t size) {
+      buffer.insert(buffer.end(), static_cast<const char *>(data), static_cast<const char *>(data) + size);
+    };
+
+    SnapshotHeader header = MakeSnapshotHeader(numItems);
+    append(&header, sizeof(header));
+    auto writeList = [&](const LruList &lruList) {
+      for (const Node *node = lruList.tail; node != nullptr; node = node->lruPrev)
+      {
+        SnapshotRecord record = {node->expiryTime, node->lastAccessTime, node->priority,
+                                 static_cast<uint32_t>(KeyTraits<Key>::SnapshotSize(node->key))};
+        append(&record, sizeof(record));
+        append(&node->value, sizeof(Value));
+        buffer.resize(buffer.size() + record.keyLength);
+        KeyTraits<Key>::SnapshotWrite(node->key, buffer.data() + buffer.size() - record.keyLength);
+        if (buffer.size() >= kSnapshotBufferBytes)
+        {
+          flush();
+        }
+      }
+    };
+    for (const LruList &lruList : denseLRU)
+    {
+      writeList(lruList);
+    }
+    for (const auto &entry : priorityLRU)
+    {
+      writeList(entry.second);
+    }
+    flush();
+
+    ok = fclose(file) == 0 && ok;
+    ok = ok && rename(tmpPath.c_str(), path) == 0;
+    if (!ok)
+    {
+      remove(tmpPath.c_str());
+    }
+    return ok;
+  }
+
+  // Replace the contents with a snapshot written by SaveSnapshot, dropping
+  // entries that expired in the meantime. The file is mapped, not read;
+  // records become nodes in one pass, and the index and the expiry heap
+  // are then built in bulk. Loading is CPU-bound, not I/O-bound: about
+  // 0.2 s per 1M entries (snapshottest, one core), two thirds of it
+  // building the nodes, against a few ms to read the file.
+  // Returns false, leaving the cache empty, if the file is missing or bad.
+  bool LoadSnapshot(const char *path)
+  {
+    static_assert(KeyTraits<Key>::kSnapshot && std::is_trivially_copyable<Value>::value,
+                  "snapshots need a std::string or trivially copyable key and a trivially copyable value");
+    Clear();
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SnapshotHeader))
+    {
+      close(fd);
+      return false;
+    }
+    size_t size = st.st_size;
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+      return false;
+    }
+    madvise(mapped, size, MADV_SEQUENTIAL);
+
+    const char *in = static_cast<const char *>(mapped);
+    const char *end = in + size;
+    SnapshotHeader header;
+    memcpy(&header, in, sizeof(header));
+    in += sizeof(header);
+    SnapshotHeader expected = MakeSnapshotHeader(header.count);
+    bool ok = memcmp(&header, &expected, sizeof(header)) == 0;
+
+    // The index and the expiry heap are built once every node exists: the
+    // index in one bulk insert, and the heap on (expiryTime, node) pairs,
+    // so sifting never chases node pointers
+    std::vector<std::pair<size_t, Node *>> hashed;
+    std::vector<std::pair<CacheTime, Node *>> expiries;
+    if (ok)
+    {
+      hashed.reserve(header.count);
+    }
+    if (ok && expiryIndex == ExpiryIndex::Heap)
+    {
+      expiries.reserve(header.count);
+    }
+
+    CacheTime now = clock.Now();
+    for (uint64_t remaining = header.count; ok && remaining > 0; --remaining)
+    {
+      SnapshotRecord record;
+      if (static_cast<size_t>(end - in) < sizeof(SnapshotRecord))
+      {
+        ok = false;
+        break;
+      }
+      memcpy(&record, in, sizeof(SnapshotRecord));
+      in += sizeof(SnapshotRecord);
+      if (static_cast<size_t>(end - in) < sizeof(Value) + record.keyLength)
+      {
+        ok = false;
+        break;
+      }
+      const char *valueBytes = in;
+      KeyView key = KeyTraits<Key>::SnapshotRead(in + sizeof(Value), record.keyLength);
+      in += sizeof(Value) + record.keyLength;
+      if (record.expiryTime < now)
+      {
+        continue;
+      }
+
+      // The value bytes are unaligned in the file; copy them out first
+      alignas(Value) char valueStorage[sizeof(Value)];
+      memcpy(valueStorage, valueBytes, sizeof(Value));
+      const Value &value = *std::launder(reinterpret_cast<const Value *>(valueStorage));
+
+      // Insert() minus the index and the heap, which are built below
+      size_t hash = HashKey(key);
+      Node *node = new (pool.Allocate()) Node(key, hash, value);
+      node->priority = record.priority;
+      node->expiryTime = record.expiryTime;
+      node->lastAccessTime = record.lastAccessTime;
+      node->ttl = TtlTicks(node->expiryTime, now);
+      hashed.emplace_back(hash, node);
+      LinkLRU(node);
+      if (expiryIndex == ExpiryIndex::Heap)
+      {
+        expiries.emplace_back(node->expiryTime, node);
+      }
+      else
+      {
+        ExpiryInsert(node);
+      }
+      Charge(node);
+      ++numItems;
+    }
+    munmap(mapped, size);
+
+    index.InsertBulk(hashed);
+    // Floyd's heap construction, O(n) instead of n sift-ups
+    auto later = [](const std::pair<CacheTime, Node *> &a, const std::pair<CacheTime, Node *> &b) {
+      return a.first > b.first;
+    };
+    std::make_heap(expiries.begin(), expiries.end(), later);
+    expiryHeap.reserve(expiries.size());
+    for (const auto &entry : expiries)
+    {
+      entry.second->expiryPos = static_cast<uint32_t>(expiryHeap.size());
+      expiryHeap.push_back(entry.second);
+    }
+
+    if (!ok)
+    {
+      Clear();
+      return false;
+    }
+    EvictItems(); // The snapshot may come from a larger cache
+    return true;
+  }
+
+  // Peek at the entry EvictLowest() would remove: the least recently used
+  // entry of the lowest priority. Returns false if the cache is empty. In
+  // Recency::Clock mode this is the list tail, which may yet be spared.
+  bool PeekEvictionCandidate(int &priority, CacheTime &lastAccessTime) const
+  {
+    const LruList *lruList = LowestPriorityList(priority);
+    if (lruList == nullptr)
+    {
+      return false;
+    }
+    lastAccessTime = lruList->tail->lastAccessTime;
+    return true;
+  }
+
+  // Evict exactly one entry by priority/LRU, ignoring maxItems
+  // In Recency::Clock mode a referenced tail has its bit cleared and goes
+  // back to the front (second chance); this ends after at most one pass
+  // over the list, when every bit has been cleared.
+  void EvictLowest()
+  {
+    int priority;
+    if (LowestPriorityList(priority) == nullptr)
+    {
+      return;
+    }
+    LruList &lruList = ListFor(priority);
+    while (lruList.tail->referenced)
+    {
+      Node *node = lruList.tail;
+      node->referenced = false;
+      lruList.Unlink(node);
+      lruList.PushFront(node);
+    }
+    RemoveNode(lruList.tail, EvictReason::Capacity);
+  }
+
+  template <typename Fn>
+  void ForEachKey(Fn fn) const
+  {
+    ForEachNode([&fn](Node *node) { fn(node->key); });
+  }
+
+  // Debug function to print all keys in the cache for debugging
+  void DebugPrintKeys()
+  {
+    std::vector<Key> keys;
+    ForEachKey([&keys](const Key &key) { keys.push_back(key); });
+    std::sort(keys.begin(), keys.end());
+    for (const auto &key : keys)
+    {
+      std::cout << key << " ";
+    }
+    std::cout << std::endl;
+  }
+};
+
+typedef BasicPriorityExpiryCache<std::string, CacheData> PriorityExpiryCache;
+typedef PriorityExpiryCache::Write CacheWrite;
+
+// A fixed set of threads running submitted tasks in order of submission.
+// Tasks must not throw. The destructor runs whatever is still queued.
+class WorkerPool
+{
+  private:
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable idle;
+  std::queue<std::function<void()>> tasks; // Guarded by mutex, like the two below
+  size_t running = 0;
+  bool stopping = false;
+  std::vector<std::thread> threads;
+
+  void Run()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+      wake.wait(lock, [this]() { return stopping || !tasks.empty(); });
+      if (tasks.empty())
+      {
+        return; // Stopping, and nothing left
+      }
+      std::function<void()> task = std::move(tasks.front());
+      tasks.pop();
+      ++running;
+      lock.unlock();
+      task();
+      lock.lock();
+      --running;
+      if (tasks.empty() && running == 0)
+      {
+        idle.notify_all();
+      }
+    }
+  }
+
+  public:
+  explicit WorkerPool(int numThreads)
+  {
+    for (int i = 0; i < std::max(numThreads, 1); ++i)
+    {
+      threads.emplace_back(&WorkerPool::Run, this);
+    }
+  }
+
+  ~WorkerPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &thread : threads)
+    {
+      thread.join();
+    }
+  }
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  void Submit(std::function<void()> task)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push(std::move(task));
+    }
+    wake.notify_one();
+  }
+
+  // Block until every task submitted so far, and any they submitted, has run
+  void Wait()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this]() { return tasks.empty() && running == 0; });
+  }
+};
+
+// N independent PriorityExpiryCache shards selected by key hash, each behind
+// its own mutex. Every shard gets ceil(maxItems / N) items, so the global
+// budget is enforced approximately (at most N - 1 extra items) on the hot
+// path, and exactly when EnforceCapacity() is called.
+//
+// With ReadMode::LockFree, Get takes no lock. Every call that changes a
+// shard runs inside a write section that makes the shard's sequence
+// number odd, and a reader copies the entry out and retries if the number
+// moved meanwhile (a seqlock), taking the lock after a few failed tries.
+// What the reader may dereference is kept alive by epochs: removed nodes
+// and index tables are only freed once every reader that entered before
+// their removal has left. The hit is queued in a small per-thread-stripe
+// buffer, and the next writer replays the queued hits under the lock
+// (a reader whose buffer is half full does it too, if the lock is free);
+// a full buffer drops hits, so recency is approximate under heavy reads.
+// Queued hits point at nodes, so the buffers are emptied before anything
+// is freed.
+//
+// With CacheOptions::refreshAhead and a loader from SetRefreshLoader, a
+// Get hit inside an entry's refresh window hands the key to a worker
+// pool, which loads it and writes it back with the same TTL and priority
+// while readers keep getting the old value. Only the first hit in the
+// window schedules anything, and a write or Remove of the key while it
+// loads wins over the loaded value. Refreshes and GetOrLoad loads share
+// the per-key single-flight, so a key is loaded by one of them.
+template <typename Cache>
+class BasicShardedPriorityExpiryCache
+{
+  public:
+  typedef typename Cache::KeyView KeyView;
+  typedef typename Cache::ValueType Value;
+  typedef typename Cache::Write Write;
+
+  private:
+  static constexpr size_t kReaderSlots = 16;    // Stripes reader threads are spread over
+  static constexpr uint32_t kReadBufferSize = 32; // Hits one stripe can queue
+  static constexpr int kOptimisticTries = 4;     // Before a reader falls back to the lock
+  static constexpr size_t kReclaimBatch = 64;    // Retired nodes worth a reclamation attempt
+
+  // A queued lock-free Get. hash is written last and is zero until then.
+  struct QueuedGet
+  {
+    std::atomic<const void *> entry{nullptr}; // From ReadConcurrent; nullptr for a miss
+    std::atomic<size_t> hash{0};
+  };
+
+  // One stripe of readers, starting on its own cache line: how many are
+  // inside in each epoch parity, and a ring of their Gets for the writers
+  struct alignas(64) ReaderSlot
+  {
+    std::atomic<int64_t> active[2] = {};
+    std::atomic<uint32_t> tail{0}; // Next cell a reader claims
+    std::atomic<uint32_t> head{0}; // Next cell the writer replays
+    QueuedGet queue[kReadBufferSize];
+  };
+
+  // A running load. written says the key was Set or removed since; a
+  // refresh then drops its older value.
+  struct Loading
+  {
+    std::shared_future<Value> result;
+    bool written = false;
+  };
+
+  // Shards are allocated separately, so their mutexes do not share a cache line
+  struct Shard
+  {
+    std::mutex mutex;
+    Cache cache;
+    const bool lockFree;
+
+    // ReadMode::LockFree only. version is odd while a writer is inside;
+    // epoch only moves under the mutex, once the readers of the epoch
+    // before it are gone, and then what was retired before the previous
+    // move (pending) is freed.
+    alignas(64) std::atomic<uint64_t> version{0};
+    std::atomic<uint64_t> epoch{0};
+    typename Cache::RetiredCounts pending{0, 0};
+    ReaderSlot readers[kReaderSlots];
+
+    // GetOrLoad calls and refreshes whose loader is running, under the mutex
+    std::unordered_map<typename Cache::KeyType, Loading> loading;
+
+    Shard(int maxItems, const CacheOptions &options, const typename Cache::ListenerType &listener)
+        : cache(maxItems, options, typename Cache::ClockType(), listener),
+          lockFree(options.readMode == ReadMode::LockFree) {}
+  };
+
+  // Brackets a change to a locked shard. In LockFree mode the queued hits
+  // are replayed first and retired memory is freed afterwards if it can be.
+  class WriteSection
+  {
+    private:
+    Shard &shard;
+
+    public:
+    explicit WriteSection(Shard &shard) : shard(shard)
+    {
+      BeginWrite(shard);
+    }
+
+    ~WriteSection()
+    {
+      EndWrite(shard);
+    }
+
+    WriteSection(const WriteSection &) = delete;
+    WriteSection &operator=(const WriteSection &) = delete;
+  };
+
+  std::atomic<int> maxItems; // Written by SetMaxItems without the shard locks
+  std::vector<std::unique_ptr<Shard>> shards;
+  std::function<Value(KeyView)> refreshLoader;
+  std::unique_ptr<WorkerPool> refreshPool; // Declared last: its tasks use the shards
+
+  static void BeginWrite(Shard &shard)
+  {
+    if (shard.lockFree)
+    {
+      ReplayHits(shard);
+      shard.version.store(shard.version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release); // Odd before any change
+    }
+  }
+
+  static void EndWrite(Shard &shard)
+  {
+    if (shard.lockFree)
+    {
+      shard.version.store(shard.version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+      Reclaim(shard);
+    }
+  }
+
+  // Called under the mutex; LRU order and the sketch are not read by
+  // lock-free readers, so this needs no write section. Returns false if
+  // some cell was claimed but not written yet; it is replayed next time.
+  static bool ReplayHits(Shard &shard)
+  {
+    bool complete = true;
+    for (ReaderSlot &slot : shard.readers)
+    {
+      uint32_t head = slot.head.load(std::memory_order_relaxed);
+      for (uint32_t tail = slot.tail.load(std::memory_order_acquire); head != tail; ++head)
+      {
+        QueuedGet &get = slot.queue[head % kReadBufferSize];
+        size_t hash = get.hash.exchange(0, std::memory_order_acquire);
+        if (hash == 0)
+        {
+          complete = false;
+          break;
+        }
+        shard.cache.ReplayGet(get.entry.load(std::memory_order_relaxed), hash);
+      }
+      slot.head.store(head, std::memory_order_release);
+    }
+    return complete;
+  }
+
+  // Called under the mutex. Nodes retired before the last epoch move are
+  // safe once no reader is left from the epoch before the current one and
+  // the hits those readers queued have been replayed.
+  static void Reclaim(Shard &shard)
+  {
+    typename Cache::RetiredCounts retired = shard.cache.Retired();
+    if (retired.nodes < kReclaimBatch && retired.tables == 0)
+    {
+      return;
+    }
+    uint64_t epoch = shard.epoch.load(std::memory_order_relaxed);
+    for (ReaderSlot &slot : shard.readers)
+    {
+      if (slot.active[(epoch + 1) & 1].load() != 0)
+      {
+        return;
+      }
+    }
+    if (!ReplayHits(shard))
+    {
+      return;
+    }
+    shard.cache.FreeRetired(shard.pending);
+    shard.pending = {retired.nodes - shard.pending.nodes, retired.tables - shard.pending.tables};
+    shard.epoch.store(epoch + 1);
+  }
+
+  // The stripe this thread reads through, fixed for its lifetime
+  static ReaderSlot &SlotFor(Shard &shard)
+  {
+    static std::atomic<size_t> nextThread{0};
+    thread_local size_t slot = nextThread.fetch_add(1, std::memory_order_relaxed) % kReaderSlots;
+    return shard.readers[slot];
+  }
+
+  // Register as a reader of the current epoch; the recheck makes sure a
+  // writer that moved the epoch meanwhile either sees this reader or is
+  // seen by it (both sides use sequentially consistent operations)
+  static uint64_t EnterEpoch(Shard &shard, ReaderSlot &slot)
+  {
+    for (;;)
+    {
+      uint64_t epoch = shard.epoch.load();
+      slot.active[epoch & 1].fetch_add(1);
+      if (shard.epoch.load() == epoch)
+      {
+        return epoch;
+      }
+      slot.active[epoch & 1].fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+
+  // Queue a lock-free Get for the writers, from inside the reader's epoch
+  // so entry cannot be freed before it is replayed. Dropped if the ring is
+  // full or another thread of the stripe is claiming the same cell.
+  // Returns whether the ring is at least half full.
+  static bool QueueGet(ReaderSlot &slot, const void *entry, size_t hash)
+  {
+    if (hash == 0)
+    {
+      return false; // Would read as an unwritten cell
+    }
+    uint32_t tail = slot.tail.load(std::memory_order_relaxed);
+    uint32_t queued = tail - slot.head.load(std::memory_order_acquire);
+    if (queued >= kReadBufferSize || !slot.tail.compare_exchange_strong(tail, tail + 1, std::memory_order_relaxed))
+    {
+      return false;
+    }
+    QueuedGet &get = slot.queue[tail % kReadBufferSize];
+    get.entry.store(entry, std::memory_order_relaxed);
+    get.hash.store(hash, std::memory_order_release);
+    return queued + 1 >= kReadBufferSize / 2;
+  }
+
+  bool GetLockFree(Shard &shard, KeyView key, size_t hash, Value &value, typename Cache::Refresh &refresh)
+  {
+    ReaderSlot &slot = SlotFor(shard);
+    uint64_t epoch = EnterEpoch(shard, slot);
+    Value copy;
+    const void *entry = nullptr;
+    bool found = false, consistent = false;
+    for (int i = 0; i < kOptimisticTries && !consistent; ++i)
+    {
+      uint64_t version = shard.version.load(std::memory_order_acquire);
+      if (version & 1)
+      {
+        std::this_thread::yield(); // A writer is inside
+        continue;
+      }
+      auto stable = [&shard, version]() {
+        std::atomic_thread_fence(std::memory_order_acquire); // Keep the reads before the recheck
+        return shard.version.load(std::memory_order_relaxed) == version;
+      };
+      refresh = typename Cache::Refresh();
+      found = shard.cache.ReadConcurrent(key, hash, copy, entry, refresh, stable);
+      consistent = stable();
+    }
+    bool replay = consistent && (found || shard.cache.CountsMisses()) && QueueGet(slot, found ? entry : nullptr, hash);
+    if (consistent && found && refresh.due)
+    {
+      refresh.due = shard.cache.ClaimRefresh(entry); // Still inside the epoch
+    }
+    slot.active[epoch & 1].fetch_sub(1, std::memory_order_release);
+
+    if (!consistent)
+    {
+      refresh = typename Cache::Refresh();
+      return GetLocked(shard, key, hash, value, refresh);
+    }
+    if (replay && shard.mutex.try_lock())
+    {
+      ReplayHits(shard);
+      shard.mutex.unlock();
+    }
+    if (found)
+    {
+      value = copy;
+    }
+    return found;
+  }
+
+  // A write section, since Get may reclaim an expired entry
+  static bool GetLocked(Shard &shard, KeyView key, size_t hash, Value &value, typename Cache::Refresh &refresh)
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    WriteSection write(shard);
+    Value *found = shard.cache.Get(key, hash, refresh);
+    if (found == nullptr)
+    {
+      return false;
+    }
+    value = *found;
+    return true;
+  }
+
+  // Hand a key whose refresh this caller claimed to the pool, unless it is
+  // loading already; then the entry just expires on time. The new value
+  // keeps the entry's priority and TTL, and is dropped if the key was
+  // written or removed while it loaded. It is stored even if the entry
+  // expired meanwhile: that is the slow load refresh-ahead is for.
+  void ScheduleRefresh(Shard &shard, KeyView key, size_t hash, const typename Cache::Refresh &refresh)
+  {
+    if (refreshPool == nullptr)
+    {
+      return;
+    }
+    // std::function needs a copyable task, hence the shared promise
+    auto promise = std::make_shared<std::promise<Value>>();
+    typename Cache::KeyType ownedKey(key);
+    {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      if (!shard.loading.emplace(ownedKey, Loading{promise->get_future().share()}).second)
+      {
+        return;
+      }
+    }
+    refreshPool->Submit([this, &shard, ownedKey, hash, refresh, promise]() {
+      try
+      {
+        Value value = refreshLoader(ownedKey);
+        {
+          std::lock_guard<std::mutex> lock(shard.mutex);
+          WriteSection write(shard);
+          auto loading = shard.loading.find(ownedKey);
+          if (!loading->second.written)
+          {
+            shard.cache.FinishRefresh(ownedKey, hash, value, refresh);
+          }
+          shard.loading.erase(loading);
+        }
+        promise->set_value(std::move(value));
+      }
+      catch (...)
+      {
+        {
+          std::lock_guard<std::mutex> lock(shard.mutex);
+          shard.loading.erase(ownedKey);
+        }
+        promise->set_exception(std::current_exception()); // The entry just expires on time
+      }
+    });
+  }
+
+  // Under the mutex, after a write or removal of key: a load running for
+  // it is out of date
+  static void MarkWritten(Shard &shard, KeyView key)
+  {
+    if (shard.loading.empty())
+    {
+      return;
+    }
+    auto loading = shard.loading.find(typename Cache::KeyType(key));
+    if (loading != shard.loading.end())
+    {
+      loading->second.written = true;
+    }
+  }
+
+  size_t ShardIndex(size_t hash) const
+  {
+    // Remix the hash so shard selection is independent of the index group
+    // and tag each shard derives from the low bits of the same hash value.
+    uint64_t h = hash * 0x9E3779B97F4A7C15ull;
+    return (h >> 32) % shards.size();
+  }
+
+  Shard &ShardFor(size_t hash)
+  {
+    return *shards[ShardIndex(hash)];
+  }
+
+  // Group batch positions by shard so each shard is locked once per batch
+  template <typename KeyOf>
+  std::vector<std::vector<size_t>> GroupByShard(size_t count, KeyOf keyOf, std::vector<size_t> &hashes) const
+  {
+    std::vector<std::vector<size_t>> positions(shards.size());
+    hashes.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+      hashes[i] = Cache::HashKey(keyOf(i));
+      positions[ShardIndex(hashes[i])].push_back(i);
+    }
+    return positions;
+  }
+
+  int PerShardMaxItems(int numItems) const
+  {
+    int n = static_cast<int>(shards.size());
+    return (numItems + n - 1) / n;
+  }
+
+  // The miss path of GetOrLoad: join the key's running load or start one.
+  // The loader runs without the lock; its result is stored and the load
+  // forgotten in one critical section, so a later caller finds one or
+  // the other.
+  template <typename Loader>
+  std::shared_future<Value> Load(KeyView key, size_t hash, Loader &loader, int priority, int expiryInSecs)
+  {
+    Shard &shard = ShardFor(hash);
+    std::promise<Value> promise;
+    std::shared_future<Value> result = promise.get_future().share();
+    typename Cache::Refresh refresh;
+    bool hit = false;
+    {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      WriteSection write(shard);
+      Value *found = shard.cache.Get(key, hash, refresh); // Stored since our miss?
+      if (found != nullptr)
+      {
+        promise.set_value(*found);
+        hit = true;
+      }
+      else
+      {
+        auto inserted = shard.loading.emplace(typename Cache::KeyType(key), Loading{result});
+        if (!inserted.second)
+        {
+          return inserted.first->second.result;
+        }
+      }
+    }
+    if (hit)
+    {
+      if (refresh.due)
+      {
+        ScheduleRefresh(shard, key, hash, refresh);
+      }
+      return result;
+    }
+
+    try
+    {
+      Value value = loader(key);
+      {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        WriteSection write(shard);
+        shard.cache.Set(key, hash, value, priority, expiryInSecs);
+        shard.loading.erase(typename Cache::KeyType(key));
+      }
+      promise.set_value(std::move(value));
+    }
+    catch (...)
+    {
+      {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.loading.erase(typename Cache::KeyType(key));
+      }
+      promise.set_exception(std::current_exception());
+    }
+    return result;
+  }
+
+  public:
+  // options.maxBytes is split evenly across the shards, like maxItems.
+  // Every shard gets a copy of listener, which is called under that
+  // shard's lock, so one listener target may be fed by several threads.
+  // ReadMode::LockFree is ignored unless the value type is trivially
+  // copyable; a reader could not copy anything else out safely.
+  BasicShardedPriorityExpiryCache(int maxItems, int numShards, const CacheOptions &options = CacheOptions(),
+                                  const typename Cache::ListenerType &listener = typename Cache::ListenerType())
+      : maxItems(maxItems)
+  {
+    numShards = std::max(numShards, 1);
+    CacheOptions shardOptions = options;
+    shardOptions.maxBytes = (options.maxBytes + numShards - 1) / numShards;
+    if (!std::is_trivially_copyable<Value>::value)
+    {
+      shardOptions.readMode = ReadMode::Locked;
+    }
+    for (int i = 0; i < numShards; ++i)
+    {
+      shards.emplace_back(new Shard(0, shardOptions, listener));
+    }
+    SetMaxItems(maxItems);
+  }
+
+  // Copy the value out under the shard lock; a pointer into the shard
+  // would dangle as soon as the lock is released.
+  bool Get(KeyView key, Value &value)
+  {
+    return Get(key, Cache::HashKey(key), value);
+  }
+
+  // The hash picks the shard and is handed down, so a lookup hashes once
+  bool Get(KeyView key, size_t hash, Value &value)
+  {
+    Shard &shard = ShardFor(hash);
+    typename Cache::Refresh refresh;
+    bool found;
+    if constexpr (std::is_trivially_copyable<Value>::value)
+    {
+      found = shard.lockFree ? GetLockFree(shard, key, hash, value, refresh)
+                             : GetLocked(shard, key, hash, value, refresh);
+    }
+    else
+    {
+      found = GetLocked(shard, key, hash, value, refresh);
+    }
+    if (refresh.due)
+    {
+      ScheduleRefresh(shard, key, hash, refresh); // After the lock is gone
+    }
+    return found;
+  }
+
+  // Turn on refresh-ahead (see CacheOptions::refreshAhead) with loader(key)
+  // run on numThreads background threads. Call it before the cache is
+  // shared; refreshes still queued from an earlier call run first.
+  void SetRefreshLoader(std::function<Value(KeyView)> loader, int numThreads = 2)
+  {
+    refreshPool.reset();
+    refreshLoader = std::move(loader);
+    refreshPool.reset(new WorkerPool(numThreads));
+  }
+
+  // Block until every refresh scheduled so far has been stored (or failed)
+  void WaitForRefreshes()
+  {
+    if (refreshPool != nullptr)
+    {
+      refreshPool->Wait();
+    }
+  }
+
+  // Get, or on a miss call loader(key) and Set what it returns. Misses on
+  // the same key coalesce: while one caller's loader runs, the others wait
+  // for its result instead of calling their own, so an expired hot key
+  // costs the backend one load. If the loader throws, every waiter gets
+  // the exception and nothing is stored. A Set of the key while it loads
+  // is overwritten by the loaded value.
+  template <typename Loader>
+  Value GetOrLoad(KeyView key, Loader loader, int priority, int expiryInSecs)
+  {
+    size_t hash = Cache::HashKey(key);
+    Value value;
+    if (Get(key, hash, value))
+    {
+      return value;
+    }
+    return Load(key, hash, loader, priority, expiryInSecs).get();
+  }
+
+  // Same, without waiting on someone else's load: the future is ready at
+  // once on a hit or when this caller ran the loader, and otherwise is the
+  // running load's, to be waited on or polled later.
+  template <typename Loader>
+  std::shared_future<Value> GetOrLoadShared(KeyView key, Loader loader, int priority, int expiryInSecs)
+  {
+    size_t hash = Cache::HashKey(key);
+    Value value;
+    if (Get(key, hash, value))
+    {
+      std::promise<Value> hit;
+      hit.set_value(std::move(value));
+      return hit.get_future().share();
+    }
+    return Load(key, hash, loader, priority, expiryInSecs);
+  }
+
+  void Set(KeyView key, Value value, int priority, int expiryInSecs)
+  {
+    Set(key, Cache::HashKey(key), std::move(value), priority, expiryInSecs);
+  }
+
+  void Set(KeyView key, size_t hash, Value value, int priority, int expiryInSecs)
+  {
+    Shard &shard = ShardFor(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    WriteSection write(shard);
+    shard.cache.Set(key, hash, std::move(value), priority, expiryInSecs);
+    MarkWritten(shard, key);
+  }
+
+  template <typename... Args>
+  void Emplace(KeyView key, int priority, int expiryInSecs, Args &&...args)
+  {
+    Shard &shard = ShardFor(Cache::HashKey(key));
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    WriteSection write(shard);
+    shard.cache.Emplace(key, priority, expiryInSecs, std::forward<Args>(args)...);
+    MarkWritten(shard, key);
+  }
+
+  bool Remove(KeyView key)
+  {
+    size_t hash = Cache::HashKey(key);
+    Shard &shard = ShardFor(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    WriteSection write(shard);
+    MarkWritten(shard, key);
+    return shard.cache.Remove(key, hash);
+  }
+
+  // Batched Get: found[i] says whether values[i] was filled in. It locks
+  // each shard once in every ReadMode, and counts as a write section.
+  void MultiGet(const KeyView *keys, size_t count, Value *values, bool *found)
+  {
+    std::vector<size_t> hashes;
+    auto positions = GroupByShard(count, [keys](size_t i) { return keys[i]; }, hashes);
+    std::vector<KeyView> shardKeys;
+    std::vector<size_t> shardHashes;
+    std::vector<Value *> shardValues;
+    std::vector<typename Cache::Refresh> shardRefreshes;
+    for (size_t s = 0; s < shards.size(); ++s)
+    {
+      if (positions[s].empty())
+      {
+        continue;
+      }
+      shardKeys.clear();
+      shardHashes.clear();
+      for (size_t i : positions[s])
+      {
+        shardKeys.push_back(keys[i]);
+        shardHashes.push_back(hashes[i]);
+      }
+      shardValues.resize(shardKeys.size());
+      shardRefreshes.assign(shardKeys.size(), typename Cache::Refresh());
+      {
+        std::lock_guard<std::mutex> lock(shards[s]->mutex);
+        WriteSection write(*shards[s]);
+        shards[s]->cache.MultiGet(shardKeys.data(), shardHashes.data(), shardKeys.size(), shardValues.data(),
+                                  shardRefreshes.data());
+        for (size_t j = 0; j < shardValues.size(); ++j)
+        {
+          size_t i = positions[s][j];
+          found[i] = shardValues[j] != nullptr;
+          if (found[i])
+          {
+            values[i] = *shardValues[j];
+          }
+        }
+      }
+      for (size_t j = 0; j < shardRefreshes.size(); ++j)
+      {
+        if (shardRefreshes[j].due)
+        {
+          ScheduleRefresh(*shards[s], shardKeys[j], shardHashes[j], shardRefreshes[j]);
+        }
+      }
+    }
+  }
+
+  // Batched Set: one lock and one eviction pass per touched shard
+  void MultiSet(const Write *writes, size_t count)
+  {
+    std::vector<size_t> hashes;
+    auto positions = GroupByShard(count, [writes](size_t i) { return writes[i].key; }, hashes);
+    std::vector<Write> shardWrites;
+    std::vector<size_t> shardHashes;
+    for (size_t s = 0; s < shards.size(); ++s)
+    {
+      if (positions[s].empty())
+      {
+        continue;
+      }
+      shardWrites.clear();
+      shardHashes.clear();
+      for (size_t i : positions[s])
+      {
+        shardWrites.push_back(writes[i]);
+        shardHashes.push_back(hashes[i]);
+      }
+      std::lock_guard<std::mutex> lock(shards[s]->mutex);
+      WriteSection write(*shards[s]);
+      shards[s]->cache.MultiSet(shardWrites.data(), shardHashes.data(), shardWrites.size());
+      for (const Write &written : shardWrites)
+      {
+        MarkWritten(*shards[s], written.key);
+      }
+    }
+  }
+
+  void SetMaxItems(int numItems)
+  {
+    maxItems.store(numItems);
+    int perShard = PerShardMaxItems(numItems);
+    for (auto &shard : shards)
+    {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      WriteSection write(*shard);
+      shard->cache.SetMaxItems(perShard);
+    }
+  }
+
+  // Each shard gets ceil(bytes / N); EnforceCapacity only tightens the item count
+  void SetMaxBytes(size_t bytes)
+  {
+    size_t perShard = (bytes + shards.size() - 1) / shards.size();
+    for (auto &shard : shards)
+    {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      WriteSection write(*shard);
+      shard->cache.SetMaxBytes(perShard);
+    }
+  }
+
+  size_t Size()
+  {
+    size_t total = 0;
+    for (auto &shard : shards)
+    {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      total += shard->cache.Size();
+    }
+    return total;
+  }
+
+  // Reclaim at most budgetPerShard expired entries from each shard, holding
+  // one shard lock at a time; meant to be called periodically by a reaper.
+  size_t ReapExpired(size_t budgetPerShard)
+  {
+    size_t reaped = 0;
+    for (auto &shard : shards)
+    {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      WriteSection write(*shard);
+      reaped += shard->cache.ReapExpired(budgetPerShard);
+    }
+    return reaped;
+  }
+
+  // Bring the total down to exactly maxItems with the same rules as the
+  // unsharded cache: expired items first in every shard, then the globally
+  // lowest priority, least recently used item across all shards.
+  void EnforceCapacity()
+  {
+    size_t limit = static_cast<size_t>(maxItems.load()); // Once: SetMaxItems may run meanwhile
+
+    // Lock every shard in index order so concurrent callers cannot deadlock
+    std::vector<std::unique_lock<std::mutex>> locks;
+    locks.reserve(shards.size());
+    size_t total = 0;
+    for (auto &shard : shards)
+    {
+      locks.emplace_back(shard->mutex);
+      BeginWrite(*shard);
+      shard->cache.EvictItems();
+      total += shard->cache.Size();
+    }
+
+    while (total > limit)
+    {
+      Shard *victim = nullptr;
+      int victimPriority = 0;
+      CacheTime victimAccessTime = 0;
+      for (auto &shard : shards)
+      {
+        int priority;
+        CacheTime lastAccessTime;
+        if (!shard->cache.PeekEvictionCandidate(priority, lastAccessTime))
+        {
+          continue;
+        }
+        if (victim == nullptr || priority < victimPriority ||
+            (priority == victimPriority && lastAccessTime < victimAccessTime))
+        {
+          victim = shard.get();
+          victimPriority = priority;
+          victimAccessTime = lastAccessTime;
+        }
+      }
+      victim->cache.EvictLowest();
+      --total;
+    }
+    for (auto &shard : shards)
+    {
+      EndWrite(*shard);
+    }
+  }
+
+  void DebugPrintKeys()
+  {
+    std::vector<typename Cache::KeyType> keys;
+    for (auto &shard : shards)
+    {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      shard->cache.ForEachKey([&keys](const typename Cache::KeyType &key) { keys.push_back(key); });
+    }
+    std::sort(keys.begin(), keys.end());
+    for (const auto &key : keys)
+    {
+      std::cout << key << " ";
+    }
+    std::cout << std::endl;
+  }
+};
+
+typedef BasicShardedPriorityExpiryCache<PriorityExpiryCache> ShardedPriorityExpiryCache;
+
+// Same cache with per-operation latency histograms compiled in
+typedef BasicPriorityExpiryCache<std::string, CacheData, KeyTraits<std::string>::DefaultHash, GlobalClock, CacheLatencyStats>
+    InstrumentedPriorityExpiryCache;
+
+// Unbounded multi-producer single-consumer queue (Vyukov). Push is one
+// allocation and one atomic exchange and never waits for other producers
+// or the consumer. Pop is for one thread only; it can briefly miss an
+// element whose Push is between its two steps, which shows up later.
+template <typename T>
+class MpscQueue
+{
+  private:
+  struct Node
+  {
+    std::atomic<Node *> next{nullptr};
+    alignas(T) unsigned char storage[sizeof(T)]; // Holds a T only while the node is queued
+
+    T &Value()
+    {
+      return *std::launder(reinterpret_cast<T *>(storage));
+    }
+  };
+
+  alignas(64) std::atomic<Node *> head; // Newest node; producers swap themselves in
+  alignas(64) Node *tail;               // Consumer's stub: the last node popped
+
+  public:
+  MpscQueue() : head(new Node), tail(head.load(std::memory_order_relaxed)) {}
+
+  ~MpscQueue()
+  {
+    while (Pop([](T &&) {}))
+    {
+    }
+    delete tail;
+  }
+
+  MpscQueue(const MpscQueue &) = delete;
+  MpscQueue &operator=(const MpscQueue &) = delete;
+
+  void Push(T &&value)
+  {
+    Node *node = new Node;
+    new (node->storage) T(std::move(value));
+    Node *prev = head.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  // Hand the oldest element to fn as an rvalue; false if none is visible.
+  // The popped node becomes the new stub and the old stub is freed.
+  template <typename Fn>
+  bool Pop(Fn fn)
+  {
+    Node *next = tail->next.load(std::memory_order_acquire);
+    if (next == nullptr)
+    {
+      return false;
+    }
+    fn(std::move(next->Value()));
+    next->Value().~T();
+    delete tail;
+    tail = next;
+    return true;
+  }
+
+  bool Empty() const
+  {
+    return tail->next.load(std::memory_order_acquire) == nullptr;
+  }
+};
+
+// Hands evicted entries to a Sink on its own thread: Push only moves the
+// entry into a queue node, so the Get/Set that evicted it never waits on
+// the sink's I/O, and any number of caches or shards can feed one
+// WriteBehind. Sink needs
+//   void Write(Key &&key, Value &&value, EvictReason reason);
+//   void Flush(); // Called each time the queue runs dry
+// Destroy every cache feeding it before the WriteBehind itself.
+template <typename Key, typename Value, typename Sink>
+class WriteBehind
+{
+  private:
+  struct Evicted
+  {
+    Key key;
+    Value value;
+    EvictReason reason;
+  };
+
+  Sink sink;
+  MpscQueue<Evicted> queue;
+  std::atomic<uint64_t> pushed{0};
+  std::atomic<bool> sleeping{false};
+  std::atomic<bool> stopping{false};
+
+  // The consumer sleeps on wake when the queue is empty. A producer only
+  // takes the mutex to wake it, once per idle-to-busy transition.
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable drained;
+  uint64_t flushed = 0; // Entries written and flushed, guarded by mutex
+  std::thread thread;
+
+  void Run()
+  {
+    uint64_t written = 0;
+    while (true)
+    {
+      bool wroteAny = false;
+      while (queue.Pop([this](Evicted &&entry) {
+        sink.Write(std::move(entry.key), std::move(entry.value), entry.reason);
+      }))
+      {
+        ++written;
+        wroteAny = true;
+      }
+      if (wroteAny)
+      {
+        sink.Flush();
+      }
+
+      std::unique_lock<std::mutex> lock(mutex);
+      flushed = written;
+      drained.notify_all();
+      if (stopping.load() && written == pushed.load())
+      {
+        return;
+      }
+      // Announce the sleep, then look once more so a Push that missed the
+      // flag is not left waiting; the timeout covers what slips through.
+      sleeping.store(true);
+      if (queue.Empty() && written == pushed.load())
+      {
+        wake.wait_for(lock, std::chrono::milliseconds(100));
+      }
+      sleeping.store(false);
+    }
+  }
+
+  void Wake()
+  {
+    if (sleeping.load() && sleeping.exchange(false))
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      wake.notify_one();
+    }
+  }
+
+  public:
+  template <typename... SinkArgs>
+  explicit WriteBehind(SinkArgs &&...sinkArgs) : sink(std::forward<SinkArgs>(sinkArgs)...)
+  {
+    thread = std::thread(&WriteBehind::Run, this);
+  }
+
+  // Writes out everything still queued before returning
+  ~WriteBehind()
+  {
+    stopping.store(true);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      wake.notify_one();
+    }
+    thread.join();
+  }
+
+  WriteBehind(const WriteBehind &) = delete;
+  WriteBehind &operator=(const WriteBehind &) = delete;
+
+  // Any thread
+  void Push(Key &&key, Value &&value, EvictReason reason)
+  {
+    pushed.fetch_add(1);
+    queue.Push(Evicted{std::move(key), std::move(value), reason});
+    Wake();
+  }
+
+  // Block until everything pushed before the call is written and flushed
+  void Flush()
+  {
+    uint64_t target = pushed.load();
+    std::unique_lock<std::mutex> lock(mutex);
+    wake.notify_one();
+    drained.wait(lock, [&]() { return flushed >= target; });
+  }
+
+  // Only safe to read once Flush has returned and nothing is being pushed
+  Sink &GetSink()
+  {
+    return sink;
+  }
+};
+
+// Listener policy that pushes every eviction into a WriteBehind. It is a
+// pointer, so each shard of a sharded cache can hold a copy.
+template <typename WriteBehindType>
+struct WriteBehindListener
+{
+  static constexpr bool kEnabled = true;
+
+  WriteBehindType *writeBehind = nullptr;
+
+  template <typename Key, typename Value>
+  void OnEviction(Key &&key, Value &&value, int, CacheTime, EvictReason reason)
+  {
+    writeBehind->Push(std::move(key), std::move(value), reason);
+  }
+};
+
+// Sink for tests: appends "reason key value" lines to a text file, so the
+// key and value types need operator<<
+class FileEvictionSink
+{
+  private:
+  std::ofstream out;
+  std::array<uint64_t, static_cast<size_t>(EvictReason::Count)> counts{};
+
+  public:
+  explicit FileEvictionSink(const char *path) : out(path, std::ios::trunc) {}
+
+  template <typename Key, typename Value>
+  void Write(Key &&key, Value &&value, EvictReason reason)
+  {
+    out << EvictReasonName(reason) << ' ' << key << ' ' << value << '\n';
+    ++counts[static_cast<size_t>(reason)];
+  }
+
+  void Flush()
+  {
+    out.flush();
+  }
+
+  bool Good() const
+  {
+    return out.good();
+  }
+
+  uint64_t Count(EvictReason reason) const
+  {
+    return counts[static_cast<size_t>(reason)];
+  }
+};
+
+// Log-structured store on local disk, the second tier of the tiered cache.
+// Records are only ever appended, to segment files <path>.<n>, through a
+// write buffer flushed with one pwrite per kWriteBatchBytes; an in-memory
+// hash index maps each key to its one live record. Overwritten and taken
+// records become garbage. Whenever the active segment fills up, sealed
+// segments that are mostly garbage are compacted (live records appended
+// again, the file deleted), and while the files exceed maxBytes the oldest
+// segment is dropped with whatever is still live in it, so the tier forgets
+// in the order entries were demoted. Nothing survives the object: the
+// files are deleted by the destructor. An I/O error loses entries (they
+// read as misses) but never serves wrong data.
+template <typename Key, typename Value, typename Hash = typename KeyTraits<Key>::DefaultHash>
+class DiskTier
+{
+  static_assert(KeyTraits<Key>::kSnapshot && std::is_trivially_copyable<Value>::value,
+                "the disk tier needs a std::string or trivially copyable key and a trivially copyable value");
+
+  public:
+  typedef typename KeyTraits<Key>::View KeyView;
+
+  struct Counters
+  {
+    uint64_t demoted = 0;     // Records written by Put
+    uint64_t promoted = 0;    // Records handed back by Take
+    uint64_t expired = 0;     // Found expired on Take or compaction, never served
+    uint64_t dropped = 0;     // Live records lost with the oldest segment
+    uint64_t compactions = 0; // Segments rewritten to reclaim garbage
+  };
+
+  private:
+  // On disk: a record, the value's bytes, the key's bytes
+  struct Record
+  {
+    int64_t expiryTime;
+    int32_t priority;
+    uint32_t keyLength;
+    uint32_t valueSize;
+    uint32_t reserved;
+  };
+
+  struct Location
+  {
+    uint64_t offset;
+    int64_t expiryTime;
+    uint32_t segment;
+    uint32_t length;
+    int32_t priority;
+  };
+
+  struct Segment
+  {
+    uint32_t id;
+    int fd;
+    uint64_t size;      // Including the unflushed write buffer for the active segment
+    uint64_t liveBytes; // Bytes of records the index still points at
+  };
+
+  static constexpr size_t kWriteBatchBytes = 64 << 10;
+
+  std::string path;
+  size_t maxBytes;
+  size_t segmentBytes;
+  uint64_t totalBytes = 0;
+  uint32_t nextSegmentId = 0;
+  std::vector<Segment> segments; // Oldest first; back() is the one appended to
+  std::vector<char> writeBuffer; // Tail of the active segment not yet written
+  std::vector<char> readBuffer;
+  std::unordered_map<Key, Location, Hash> index;
+  Counters counters;
+
+  std::string SegmentPath(uint32_t id) const
+  {
+    return path + "." + std::to_string(id);
+  }
+
+  Segment *FindSegment(uint32_t id)
+  {
+    auto it = std::lower_bound(segments.begin(), segments.end(), id,
+                               [](const Segment &segment, uint32_t id) { return segment.id < id; });
+    return it != segments.end() && it->id == id ? &*it : nullptr;
+  }
+
+  void OpenSegment()
+  {
+    uint32_t id = nextSegmentId++;
+    int fd = open(SegmentPath(id).c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    segments.push_back(Segment{id, fd, 0, 0});
+  }
+
+  void FlushBuffer()
+  {
+    Segment &active = segments.back();
+    uint64_t offset = active.size - writeBuffer.size();
+    size_t done = 0;
+    while (done < writeBuffer.size())
+    {
+      ssize_t n = pwrite(active.fd, writeBuffer.data() + done, writeBuffer.size() - done, offset + done);
+      if (n <= 0)
+      {
+        break; // The rest of the batch is lost; reading it fails and counts as a miss
+      }
+      done += n;
+    }
+    writeBuffer.clear();
+  }
+
+  Location Append(KeyView key, const Value &value, int priority, CacheTime expiryTime)
+  {
+    Segment &active = segments.back();
+    Record record = {expiryTime, priority, static_cast<uint32_t>(KeyTraits<Key>::SnapshotSize(key)),
+                     static_cast<uint32_t>(sizeof(Value)), 0};
+    Location location = {active.size, expiryTime, active.id,
+                         static_cast<uint32_t>(sizeof(Record) + sizeof(Value) + record.keyLength), priority};
+    size_t at = writeBuffer.size();
+    writeBuffer.resize(at + location.length);
+    memcpy(&writeBuffer[at], &record, sizeof(Record));
+    memcpy(&writeBuffer[at + sizeof(Record)], &value, sizeof(Value));
+    KeyTraits<Key>::SnapshotWrite(key, &writeBuffer[at + sizeof(Record) + sizeof(Value)]);
+    active.size += location.length;
+    active.liveBytes += location.length;
+    totalBytes += location.length;
+    if (writeBuffer.size() >= kWriteBatchBytes)
+    {
+      FlushBuffer();
+    }
+    return location;
+  }
+
+  // The record's bytes, from the write buffer or the file; nullptr on an I/O error
+  const char *ReadRecord(const Location &location)
+  {
+    const Segment &active = segments.back();
+    uint64_t flushed = active.size - writeBuffer.size();
+    if (location.segment == active.id && location.offset >= flushed)
+    {
+      return writeBuffer.data() + (location.offset - flushed);
+    }
+    Segment *segment = FindSegment(location.segment);
+    readBuffer.resize(location.length);
+    if (segment == nullptr ||
+        pread(segment->fd, readBuffer.data(), location.length, location.offset) != static_cast<ssize_t>(location.length))
+    {
+      return nullptr;
+    }
+    return readBuffer.data();
+  }
+
+  void Unindex(typename std::unordered_map<Key, Location, Hash>::iterator it)
+  {
+    FindSegment(it->second.segment)->liveBytes -= it->second.length;
+    index.erase(it);
+  }
+
+  // Walk a sealed segment and remove it. Its live records are appended
+  // again if keep is set and they have not expired; otherwise they leave
+  // the index.
+  void Retire(size_t pos, CacheTime now, bool keep)
+  {
+    Segment segment = segments[pos];
+    void *mapped = segment.size == 0 ? MAP_FAILED : mmap(nullptr, segment.size, PROT_READ, MAP_PRIVATE, segment.fd, 0);
+    if (mapped != MAP_FAILED)
+    {
+      madvise(mapped, segment.size, MADV_SEQUENTIAL);
+      const char *in = static_cast<const char *>(mapped);
+      for (uint64_t offset = 0; offset + sizeof(Record) <= segment.size;)
+      {
+        Record record;
+        memcpy(&record, in + offset, sizeof(Record));
+        uint64_t length = sizeof(Record) + sizeof(Value) + record.keyLength;
+        if (record.valueSize != sizeof(Value) || offset + length > segment.size)
+        {
+          break; // Torn tail after a failed write
+        }
+        KeyView key = KeyTraits<Key>::SnapshotRead(in + offset + sizeof(Record) + sizeof(Value), record.keyLength);
+        auto it = index.find(Key(key));
+        if (it != index.end() && it->second.segment == segment.id && it->second.offset == offset)
+        {
+          if (keep && record.expiryTime >= now)
+          {
+            Value value;
+            memcpy(&value, in + offset + sizeof(Record), sizeof(Value));
+            it->second = Append(key, value, record.priority, record.expiryTime);
+          }
+          else
+          {
+            ++(record.expiryTime < now ? counters.expired : counters.dropped);
+            index.erase(it);
+          }
+        }
+        offset += length;
+      }
+      munmap(mapped, segment.size);
+    }
+    // Records that could not be read are gone; keep the index honest
+    for (auto it = index.begin(); mapped == MAP_FAILED && segment.size != 0 && it != index.end();)
+    {
+      if (it->second.segment == segment.id)
+      {
+        ++counters.dropped;
+        it = index.erase(it);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+    close(segment.fd);
+    unlink(SegmentPath(segment.id).c_str());
+    totalBytes -= segment.size;
+    segments.erase(segments.begin() + pos);
+  }
+
+  // Seal the active segment and start a new one, then reclaim garbage and
+  // keep the files within maxBytes
+  void Roll(CacheTime now)
+  {
+    FlushBuffer();
+    OpenSegment();
+    for (size_t pos = 0; pos + 1 < segments.size();)
+    {
+      if (segments[pos].liveBytes * 2 < segments[pos].size)
+      {
+        Retire(pos, now, true);
+        ++counters.compactions;
+      }
+      else
+      {
+        ++pos;
+      }
+    }
+    while (totalBytes > maxBytes && segments.size() > 1)
+    {
+      Retire(0, now, false);
+    }
+  }
+
+  public:
+  // maxBytes bounds the segment files, which hold garbage as well as live
+  // records; it should be several segments for compaction to keep up
+  DiskTier(const char *path, size_t maxBytes, size_t segmentBytes = size_t(64) << 20)
+      : path(path), maxBytes(maxBytes), segmentBytes(segmentBytes)
+  {
+    OpenSegment();
+  }
+
+  ~DiskTier()
+  {
+    for (const Segment &segment : segments)
+    {
+      close(segment.fd);
+      unlink(SegmentPath(segment.id).c_str());
+    }
+  }
+
+  DiskTier(const DiskTier &) = delete;
+  DiskTier &operator=(const DiskTier &) = delete;
+
+  // Store an entry, replacing any older record of the key. An entry that
+  // has already expired is not written.
+  void Put(KeyView key, const Value &value, int priority, CacheTime expiryTime, CacheTime now)
+  {
+    Erase(key, now);
+    if (expiryTime < now)
+    {
+      return;
+    }
+    index.emplace(Key(key), Append(key, value, priority, expiryTime));
+    ++counters.demoted;
+    if (segments.back().size >= segmentBytes)
+    {
+      Roll(now);
+    }
+  }
+
+  // Remove the key's entry and hand it back if it is live at now. An
+  // expired entry is removed without being read.
+  bool Take(KeyView key, CacheTime now, Value &value, int &priority, CacheTime &expiryTime)
+  {
+    auto it = index.find(Key(key));
+    if (it == index.end())
+    {
+      return false;
+    }
+    Location location = it->second;
+    Unindex(it);
+    if (location.expiryTime < now)
+    {
+      ++counters.expired;
+      return false;
+    }
+    const char *record = ReadRecord(location);
+    if (record == nullptr)
+    {
+      return false;
+    }
+    memcpy(&value, record + sizeof(Record), sizeof(Value));
+    priority = location.priority;
+    expiryTime = location.expiryTime;
+    ++counters.promoted;
+    return true;
+  }
+
+  // Forget the key; returns true if its entry was live at now
+  bool Erase(KeyView key, CacheTime now)
+  {
+    auto it = index.find(Key(key));
+    if (it == index.end())
+    {
+      return false;
+    }
+    bool live = it->second.expiryTime >= now;
+    Unindex(it);
+    return live;
+  }
+
+  bool Contains(KeyView key) const
+  {
+    return index.count(Key(key)) != 0;
+  }
+
+  // Entries indexed, some possibly expired
+  size_t Size() const
+  {
+    return index.size();
+  }
+
+  // Bytes in the segment files, garbage included
+  uint64_t Bytes() const
+  {
+    return totalBytes;
+  }
+
+  const Counters &GetCounters() const
+  {
+    return counters;
+  }
+};
+
+// A PriorityExpiryCache in front of a DiskTier. Entries evicted for
+// capacity are demoted to disk instead of dropped, with their priority
+// and expiry time; a Get that misses in memory takes a live entry off the
+// disk and promotes it back. Expired entries are never demoted, and the
+// disk tier checks expiry before anything is read, so expired data is
+// never served. The memory tier's listener slot is taken by the demotion.
+template <typename Key, typename Value, typename Hash = typename KeyTraits<Key>::DefaultHash, typename Clock = GlobalClock,
+          typename Stats = NullCacheStats>
+class BasicTieredPriorityExpiryCache
 {
+  public:
+  typedef typename KeyTraits<Key>::View KeyView;
+  typedef DiskTier<Key, Value, Hash> Disk;
+
   private:
-  int maxItems;
+  struct DemoteListener
+  {
+    static constexpr bool kEnabled = true;
+
+    BasicTieredPriorityExpiryCache *owner = nullptr;
+
+    template <typename K, typename V>
+    void OnEviction(K &&key, V &&value, int priority, CacheTime expiryTime, EvictReason reason)
+    {
+      if (reason == EvictReason::Capacity || reason == EvictReason::Rejected)
+      {
+        owner->disk.Put(key, value, priority, expiryTime, owner->memory.GetClock().Now());
+      }
+    }
+  };
+
+  typedef BasicPriorityExpiryCache<Key, Value, Hash, Clock, Stats, DefaultWeigher, DemoteListener> Memory;
+
+  Disk disk; // Declared first: the memory tier's listener points at it
+  Memory memory;
+
+  // Write to memory. An entry evicted again or not admitted at all comes
+  // back through the listener and is demoted to disk.
+  void Promote(KeyView key, const Value &value, int priority, CacheTime expiryTime)
+  {
+    memory.SetUntil(key, value, priority, expiryTime);
+  }
+
+  public:
+  BasicTieredPriorityExpiryCache(int maxItems, const char *diskPath, size_t maxDiskBytes,
+                                 const CacheOptions &options = CacheOptions(), const Clock &clock = Clock(),
+                                 size_t segmentBytes = size_t(64) << 20)
+      : disk(diskPath, maxDiskBytes, segmentBytes), memory(maxItems, options, clock, DemoteListener{this}) {}
+
+  BasicTieredPriorityExpiryCache(const BasicTieredPriorityExpiryCache &) = delete;
+  BasicTieredPriorityExpiryCache &operator=(const BasicTieredPriorityExpiryCache &) = delete;
+
+  // Copy the value out, promoting it from disk if that is where it is. A
+  // promoted entry whose priority is below everything in a full memory
+  // tier is evicted by its own Set and goes straight back to disk.
+  bool Get(KeyView key, Value &value)
+  {
+    Value *found = memory.Get(key);
+    if (found != nullptr)
+    {
+      value = *found;
+      return true;
+    }
+    CacheTime now = memory.GetClock().Now();
+    int priority;
+    CacheTime expiryTime;
+    if (!disk.Take(key, now, value, priority, expiryTime))
+    {
+      return false;
+    }
+    Promote(key, value, priority, expiryTime);
+    return true;
+  }
+
+  // Writes go to memory, and an older copy on disk is forgotten. A write
+  // the admission filter turns away is stored on disk instead.
+  void Set(KeyView key, const Value &value, int priority, int expiryInSecs)
+  {
+    CacheTime now = memory.GetClock().Now();
+    disk.Erase(key, now);
+    Promote(key, value, priority, Memory::Deadline(now, expiryInSecs));
+  }
+
+  // Returns true if a live entry was removed from either tier
+  bool Remove(KeyView key)
+  {
+    bool removed = memory.Remove(key);
+    return disk.Erase(key, memory.GetClock().Now()) || removed;
+  }
+
+  void SetMaxItems(int numItems)
+  {
+    memory.SetMaxItems(numItems);
+  }
+
+  // Entries in memory
+  size_t Size() const
+  {
+    return memory.Size();
+  }
+
+  Disk &GetDisk()
+  {
+    return disk;
+  }
+
+  Stats &GetStats()
+  {
+    return memory.GetStats();
+  }
+
+  Clock &GetClock()
+  {
+    return memory.GetClock();
+  }
+};
+
+typedef BasicTieredPriorityExpiryCache<std::string, CacheData> TieredPriorityExpiryCache;
+
+// Run the load test with the given options and TTLs uniform in [0, maxExpirySecs).
+// With an instrumented Cache the latency stats are dumped at the end.
+template <typename Cache = PriorityExpiryCache>
+int loadtest(const CacheOptions &options, int maxExpirySecs)
+{
+  // Load test
+  const int numOps = 300000;
+  const int numKeys = 10000;      // Number of unique keys to be used for Set operations
+  const int numPrioritys = 20;    // Number of unique keys to be used for Set operations
+  const int numCacheSize = 10000; // Number of unique keys to be used for Set operations
+
+  // Initialize the cache with a maximum of items
+  Cache c(numCacheSize, options); // Use a larger cache size for load testing
+  srand(1); // Same key/priority/expiry sequence for every expiry index
+
+  // Build key strings up front so the timed loops measure the cache, not std::to_string
+  std::vector<std::string> keyNames;
+  std::vector<size_t> keyHashes;
+  for (int i = 0; i < numKeys; ++i)
+  {
+    keyNames.push_back("Key" + std::to_string(i));
+    keyHashes.push_back(Cache::HashKey(keyNames.back()));
+  }
+
+  // Measure time for Set operations
+  std::cout << "Start loading cache (" << (options.expiryIndex == ExpiryIndex::Heap ? "heap" : "timing wheel")
+            << ", " << (options.densePriorities > 0 ? "dense" : "sparse") << " priorities"
+            << ", TTL < " << maxExpirySecs << "s)..." << std::endl;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < numOps; ++i)
+  {
+    const std::string &key = keyNames[rand() % numKeys];
+    CacheData value = rand() % 100;
+    int priority = rand() % numPrioritys;
+    int expiryTime = rand() % maxExpirySecs;
+    c.Set(key, value, priority, expiryTime);
+    g_Time += 1; // Simulate the passage of time
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> duration = end - start;
+  std::cout << "Set operations took: " << duration.count() << " seconds" << std::endl;
+
+  // Measure time for Get operations
+  start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < numOps; ++i)
+  {
+    const std::string &key = keyNames[rand() % numKeys];
+    c.Get(key);
+    g_Time += 1; // Simulate the passage of time
+  }
+  end = std::chrono::high_resolution_clock::now();
+  duration = end - start;
+  std::cout << "Get operations took: " << duration.count() << " seconds" << std::endl;
+
+  // Same again with hashes computed up front, as a caller holding them would
+  start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < numOps; ++i)
+  {
+    int k = rand() % numKeys;
+    c.Get(keyNames[k], keyHashes[k]);
+    g_Time += 1; // Simulate the passage of time
+  }
+  end = std::chrono::high_resolution_clock::now();
+  duration = end - start;
+  std::cout << "Get operations (precomputed hash) took: " << duration.count() << " seconds" << std::endl;
+
+  // Load Test: Evictions - Simulating repeated eviction pressures
+
+  std::cout << "Start eviction load test..." << std::endl;
+  start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < numOps; ++i)
+  {
+    // Force eviction by calling EvictItems frequently
+    c.EvictItems();
+    g_Time += 1; // Simulate the passage of time
+
+    // Optionally, periodically add new items to the cache during eviction cycles
+    if (i % 100 == 0) // For example, add a new item every 100 eviction cycles
+    {
+      const std::string &key = keyNames[rand() % numKeys];
+      CacheData value = rand() % 100;
+      int priority = rand() % numPrioritys;
+      int expiryTime = rand() % maxExpirySecs;
+      c.Set(key, value, priority, expiryTime);
+    }
+  }
+  end = std::chrono::high_resolution_clock::now();
+  duration = end - start;
+  std::cout << "Eviction load test took: " << duration.count() << " seconds" << std::endl;
+
+  if constexpr (Cache::StatsType::kEnabled)
+  {
+    c.GetStats().PrintText(std::cout);
+    c.GetStats().PrintJson(std::cout);
+  }
+
+  // Memory footprint of a full cache whose entries do not expire
+  Cache full(numCacheSize, options);
+  for (int i = 0; i < numCacheSize; ++i)
+  {
+    full.Set(keyNames[i % numKeys], i, i % numPrioritys, 1000000);
+  }
+  std::cout << "Memory per entry: " << full.MemoryUsage() / full.Size() << " bytes ("
+            << full.Size() << " entries)" << std::endl;
+
+  // Optionally, debug the final state of cache keys
+  // std::cout << "Final cache keys: ";
+  // c.DebugPrintKeys();
+
+  return 0;
+}
+
+// Integer keys, 4 KB values and two caches with independent clocks in the
+// same process
+int typedtest()
+{
+  typedef std::array<char, 4096> Blob;
+  BasicPriorityExpiryCache<int, Blob, IntegerHash, ManualClock> blobs(2);
+  BasicPriorityExpiryCache<uint64_t, int, IntegerHash, ManualClock> counters(100);
+
+  Blob blob;
+  blob.fill('x');
+  blobs.Set(1, blob, 1, 10);
+  blobs.Set(2, blob, 1, 20);
+  counters.Set(42, 7, 1, 10);
+
+  blobs.GetClock().Advance(15); // Only the blob cache's time moves
+  std::cout << "Blob 1 " << (blobs.Get(1) ? "present" : "expired")
+            << ", blob 2 " << (blobs.Get(2) ? "present" : "expired")
+            << ", counter 42 " << (counters.Get(42) ? "present" : "expired") << std::endl;
+
+  // Expiry is kept in milliseconds: a 10 s TTL ends exactly 10000 ms later
+  counters.GetClock().AdvanceMillis(10000);
+  bool atDeadline = counters.Get(42) != nullptr;
+  counters.GetClock().AdvanceMillis(1);
+  std::cout << "Counter 42 " << (atDeadline ? "present" : "expired") << " at 10.000 s, "
+            << (counters.Get(42) ? "present" : "expired") << " at 10.001 s" << std::endl;
+
+  return 0;
+}
+
+// A large value that counts how it gets constructed
+struct CountedValue
+{
+  static inline int constructed = 0, copied = 0, moved = 0;
+  std::vector<char> bytes;
+
+  explicit CountedValue(size_t n = 0) : bytes(n) { ++constructed; }
+  CountedValue(const CountedValue &other) : bytes(other.bytes) { ++copied; }
+  CountedValue(CountedValue &&other) : bytes(std::move(other.bytes)) { ++moved; }
+  CountedValue &operator=(const CountedValue &other)
+  {
+    bytes = other.bytes;
+    ++copied;
+    return *this;
+  }
+  CountedValue &operator=(CountedValue &&other)
+  {
+    bytes = std::move(other.bytes);
+    ++moved;
+    return *this;
+  }
+
+  static void Reset()
+  {
+    constructed = copied = moved = 0;
+  }
+
+  static void Report(const char *what)
+  {
+    std::cout << what << ": " << constructed << " constructed, " << copied << " copied, " << moved << " moved" << std::endl;
+    Reset();
+  }
+};
+
+// How many times each write path builds, copies or moves the value
+int movetest()
+{
+  BasicPriorityExpiryCache<std::string, CountedValue> c(10);
+  CountedValue value(4096);
+  CountedValue::Reset();
+
+  c.Emplace("A", 1, 100, 4096);
+  CountedValue::Report("Emplace new key");
+  c.Emplace("A", 1, 200, 8192);
+  CountedValue::Report("Emplace existing key");
+  c.Set("B", CountedValue(4096), 1, 100);
+  CountedValue::Report("Set rvalue");
+  c.Set("B", value, 2, 100);
+  CountedValue::Report("Set lvalue over existing key");
+  try
+  {
+    c.Emplace("A", 1, 300, SIZE_MAX); // The vector throws length_error
+  }
+  catch (const std::length_error &)
+  {
+  }
+  std::cout << "Emplace that throws over A: A " << (c.Get("A") != nullptr ? "present" : "removed") << ", size "
+            << c.Size() << std::endl;
+  return 0;
+}
+
+// A clock that, once stepping, moves one second on every read, so two
+// reads inside one call see different times
+struct SteppingClock
+{
+  static constexpr CacheTime kTicksPerSecond = 1;
+
+  mutable CacheTime now = 0;
+  bool stepping = false;
+
+  CacheTime Now() const
+  {
+    return stepping ? now++ : now;
+  }
+};
+
+// Batch vs scalar: the same random Gets and Sets issued one at a time and
+// through MultiGet/MultiSet at several batch sizes, against a cache large
+// enough that most lookups miss the CPU caches and prefetching matters.
+// First, a key repeated in one MultiGet on its last live second must hit
+// both times rather than be reclaimed under the first slot's pointer.
+int batchtest()
+{
+  const int numCacheSize = 1000000;
+  const int numKeys = 2000000; // About half the lookups hit
+  const int numOps = 1000000;
+  const int numPrioritys = 20;
+
+  std::vector<std::string> keyNames;
+  for (int i = 0; i < numKeys; ++i)
+  {
+    keyNames.push_back("Key" + std::to_string(i));
+  }
+  std::mt19937 rng(1);
+  std::vector<std::string_view> keys(numOps);
+  std::vector<CacheWrite> writes(numOps);
+  for (int i = 0; i < numOps; ++i)
+  {
+    keys[i] = keyNames[rng() % numKeys];
+    writes[i] = CacheWrite{keyNames[rng() % numKeys], static_cast<CacheData>(i), static_cast<int>(rng() % numPrioritys), 1000000};
+  }
+
+  CacheOptions options;
+  options.densePriorities = numPrioritys;
+  PriorityExpiryCache c(numCacheSize, options);
+  for (int i = 0; i < numCacheSize; ++i)
+  {
+    c.Set(keyNames[2 * i], i, i % numPrioritys, 1000000);
+  }
+
+  auto nsPerOp = [&](const std::function<void()> &body) {
+    auto start = std::chrono::high_resolution_clock::now();
+    body();
+    std::chrono::duration<double, std::nano> duration = std::chrono::high_resolution_clock::now() - start;
+    return duration.count() / numOps;
+  };
+
+  std::cout << "Start batch test (" << numCacheSize << " entries)..." << std::endl;
+  {
+    BasicPriorityExpiryCache<std::string, CacheData, KeyTraits<std::string>::DefaultHash, SteppingClock> stepped(10);
+    stepped.Set("Twice", 7, 1, 10);
+    stepped.GetClock().now = 10;
+    stepped.GetClock().stepping = true;
+    std::string_view twice[2] = {"Twice", "Twice"};
+    CacheData *found[2];
+    stepped.MultiGet(twice, 2, found);
+    std::cout << "Repeated key in one batch: "
+              << (found[0] != nullptr && found[0] == found[1] ? "same entry both times" : "LOST between lookups")
+              << std::endl;
+  }
+  std::vector<CacheData *> values(numOps);
+  double scalarGet = nsPerOp([&]() {
+    for (int i = 0; i < numOps; ++i)
+    {
+      values[i] = c.Get(keys[i]);
+    }
+  });
+  double scalarSet = nsPerOp([&]() {
+    for (int i = 0; i < numOps; ++i)
+    {
+      c.Set(writes[i].key, writes[i].value, writes[i].priority, writes[i].expiryInSecs);
+    }
+  });
+  std::cout << "scalar: Get " << scalarGet << " ns/op, Set " << scalarSet << " ns/op" << std::endl;
 
-  struct CacheItem
+  for (int batchSize : {64, 128, 256, 512})
   {
-    std::string key;
-    CacheData value;
-    int priority;
-    int expiryTime;
-    int lastAccessTime;
+    double batchGet = nsPerOp([&]() {
+      for (int i = 0; i < numOps; i += batchSize)
+      {
+        c.MultiGet(&keys[i], std::min(batchSize, numOps - i), &values[i]);
+      }
+    });
+    double batchSet = nsPerOp([&]() {
+      for (int i = 0; i < numOps; i += batchSize)
+      {
+        c.MultiSet(&writes[i], std::min(batchSize, numOps - i));
+      }
+    });
+    std::cout << "batch " << batchSize << ": MultiGet " << batchGet << " ns/op, MultiSet " << batchSet
+              << " ns/op (size " << c.Size() << ")" << std::endl;
+  }
+
+  return 0;
+}
+
+// Multi-threaded load test: the same mixed Get/Set workload against one
+// mutex around a single PriorityExpiryCache and against the sharded cache,
+// reporting ops/sec for 1..N threads. g_Time is frozen while workers run
+// because it is a plain global shared by every thread.
+int concurrentLoadtest()
+{
+  const int numOpsPerThread = 200000;
+  const int numKeys = 20000;
+  const int numPrioritys = 20;
+  const int numCacheSize = 10000;
+  const int numShards = 12;
+  const int setPercent = 20;
 
-    CacheItem()
-        : key(""), value(0), priority(0), expiryTime(0), lastAccessTime(0) {}
+  std::vector<std::string> keys;
+  for (int i = 0; i < numKeys; ++i)
+  {
+    keys.push_back("Key" + std::to_string(i));
+  }
 
-    CacheItem(std::string k, CacheData v, int p, int e, int last = g_Time)
-        : key(k), value(v), priority(p), expiryTime(e), lastAccessTime(last) {}
+  int maxThreads = std::max(4, static_cast<int>(std::thread::hardware_concurrency()));
+  std::vector<int> threadCounts;
+  for (int t = 1; t < maxThreads; t *= 2)
+  {
+    threadCounts.push_back(t);
+  }
+  threadCounts.push_back(maxThreads);
 
-    bool isExpired() const
+  auto run = [&](int numThreads, const std::function<void(int, std::mt19937 &)> &op) {
+    std::vector<std::thread> workers;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int t = 0; t < numThreads; ++t)
     {
-      return expiryTime < g_Time;
+      workers.emplace_back([&, t]() {
+        std::mt19937 rng(t + 1);
+        for (int i = 0; i < numOpsPerThread; ++i)
+        {
+          op(static_cast<int>(rng() % numKeys), rng);
+        }
+      });
     }
+    for (auto &worker : workers)
+    {
+      worker.join();
+    }
+    std::chrono::duration<double> duration = std::chrono::high_resolution_clock::now() - start;
+    return numThreads * static_cast<double>(numOpsPerThread) / duration.count();
   };
 
-  // Comparator to sort CacheItem by expiry time, last access time
-  struct CacheItemComparatorForExpiry
+  std::cout << "Start concurrent load test (" << setPercent << "% Set, " << numShards << " shards)..." << std::endl;
+  for (int numThreads : threadCounts)
   {
-    bool operator()(const CacheItem &a, const CacheItem &b) const
-    {
-      if (a.key == b.key)
+    std::mutex globalMutex;
+    PriorityExpiryCache single(numCacheSize);
+    double globalOps = run(numThreads, [&](int k, std::mt19937 &rng) {
+      std::lock_guard<std::mutex> lock(globalMutex);
+      if (static_cast<int>(rng() % 100) < setPercent)
       {
-        // This is needed so that expirySet.insert(newItem) will remove the old key
-        return false;
+        single.Set(keys[k], rng() % 100, rng() % numPrioritys, 50 + rng() % 50);
       }
-      if (a.expiryTime == b.expiryTime)
+      else
       {
-        // This helps reduct time, because the tie is less and sorting algo works better
-        return a.lastAccessTime < b.lastAccessTime; // LRU tie breaker
+        single.Get(keys[k]);
       }
-      return a.expiryTime < b.expiryTime;
-    }
-  };
+    });
 
-  // Cache storage and data structures
-  std::unordered_map<std::string, CacheItem> cache;
+    ShardedPriorityExpiryCache sharded(numCacheSize, numShards);
+    double shardedOps = run(numThreads, [&](int k, std::mt19937 &rng) {
+      if (static_cast<int>(rng() % 100) < setPercent)
+      {
+        sharded.Set(keys[k], rng() % 100, rng() % numPrioritys, 50 + rng() % 50);
+      }
+      else
+      {
+        CacheData value;
+        sharded.Get(keys[k], value);
+      }
+    });
+    size_t approxSize = sharded.Size();
+    sharded.EnforceCapacity();
 
-  std::set<int> priorityQueue;                                                       // Store only the priority numbers
-  std::unordered_map<int, std::list<std::string>> priorityLRU;                       // LRU tracking for each priority
-  std::unordered_map<std::string, std::list<std::string>::iterator> cacheItemLRUMap; // Item position in its priority LRU list
-  std::set<CacheItem, CacheItemComparatorForExpiry> expirySet;
+    std::cout << numThreads << " threads: global mutex " << static_cast<long>(globalOps)
+              << " ops/sec, sharded " << static_cast<long>(shardedOps) << " ops/sec"
+              << " (size " << approxSize << " -> " << sharded.Size() << ")" << std::endl;
+  }
 
-  public:
-  // Constructor
-  PriorityExpiryCache(int maxItems)
-      : maxItems(maxItems) {}
+  return 0;
+}
+
+// Read-mostly load: 95% Get, 5% Set from 1 to 64 threads against the
+// sharded cache with locked and with lock-free reads. Lock-free reads only
+// pay off with real cores; on one core they measure the extra bookkeeping.
+int readMixtest()
+{
+  const int numOpsPerThread = 100000;
+  const int numKeys = 20000;
+  const int numPrioritys = 20;
+  const int numCacheSize = 10000;
+  const int numShards = 12;
+  const int setPercent = 5;
 
-  // Get the value of the key if it exists and is not expired
-  CacheData *Get(std::string key)
+  std::vector<std::string> keys;
+  for (int i = 0; i < numKeys; ++i)
   {
-    if (cache.find(key) == cache.end() || cache[key].isExpired())
+    keys.push_back("Key" + std::to_string(i));
+  }
+
+  auto run = [&](ShardedPriorityExpiryCache &sharded, int numThreads) {
+    std::vector<std::thread> workers;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int t = 0; t < numThreads; ++t)
+    {
+      workers.emplace_back([&, t]() {
+        std::mt19937 rng(t + 1);
+        for (int i = 0; i < numOpsPerThread; ++i)
+        {
+          const std::string &key = keys[rng() % numKeys];
+          if (static_cast<int>(rng() % 100) < setPercent)
+          {
+            sharded.Set(key, rng() % 100, rng() % numPrioritys, 50 + rng() % 50);
+          }
+          else
+          {
+            CacheData value;
+            sharded.Get(key, value);
+          }
+        }
+      });
+    }
+    for (auto &worker : workers)
     {
-      return nullptr; // Cache miss or expired
+      worker.join();
     }
+    std::chrono::duration<double> duration = std::chrono::high_resolution_clock::now() - start;
+    return numThreads * static_cast<double>(numOpsPerThread) / duration.count();
+  };
 
-    // Update last access time to reflect recent usage (LRU)
-    CacheItem &item = cache[key];
-    item.lastAccessTime = g_Time;
+  std::cout << "Start read mix test (" << setPercent << "% Set, " << numShards << " shards)..." << std::endl;
+  for (int numThreads = 1; numThreads <= 64; numThreads *= 2)
+  {
+    double ops[2];
+    size_t sizes[2];
+    for (ReadMode mode : {ReadMode::Locked, ReadMode::LockFree})
+    {
+      CacheOptions options;
+      options.readMode = mode;
+      ShardedPriorityExpiryCache sharded(numCacheSize, numShards, options);
+      for (int i = 0; i < numCacheSize; ++i)
+      {
+        sharded.Set(keys[i], i % 100, i % numPrioritys, 50 + i % 50);
+      }
+      ops[mode == ReadMode::LockFree] = run(sharded, numThreads);
+      sharded.EnforceCapacity();
+      sizes[mode == ReadMode::LockFree] = sharded.Size();
+    }
+    std::cout << numThreads << " threads: locked " << static_cast<long>(ops[0]) << " ops/sec, lock-free "
+              << static_cast<long>(ops[1]) << " ops/sec (size " << sizes[0] << ", " << sizes[1] << ")" << std::endl;
+  }
 
-    // Move the key to the front of the LRU list for its priority
-    auto &lruList = priorityLRU[item.priority];
-    lruList.erase(cacheItemLRUMap[key]);    // Remove the item from its current position in the LRU list
-    lruList.push_front(key);                // Move it to the front (most recently used)
-    cacheItemLRUMap[key] = lruList.begin(); // Update the map to point to the new position
+  return 0;
+}
 
-    return &item.value;
-  }
+// Miss stampede: 16 threads ask for the same 10 keys right after they
+// expire (removed here), against a loader that takes 1 ms. GetOrLoad should
+// call it once per key and round; Get-then-Set about once per thread.
+int singleflighttest()
+{
+  const int numThreads = 16;
+  const int numKeys = 10;
+  const int numRounds = 20;
+  const int callsPerThread = 50; // Per round, cycling over the keys
 
-  // Set the key-value pair with priority and expiry time
-  void Set(std::string key, CacheData value, int priority, int expiryInSecs)
+  std::vector<std::string> keys;
+  for (int i = 0; i < numKeys; ++i)
   {
-    if (cache.count(key)) // Remove if old key exists.
+    keys.push_back("Hot" + std::to_string(i));
+  }
+  std::atomic<int> loads{0};
+  int round = 0;
+  auto loader = [&](std::string_view key) {
+    loads.fetch_add(1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1)); // The backend
+    return static_cast<CacheData>(round * 100 + std::stoi(std::string(key.substr(3))));
+  };
+
+  auto run = [&](const std::function<CacheData(ShardedPriorityExpiryCache &, const std::string &)> &get) {
+    ShardedPriorityExpiryCache sharded(1000, 4);
+    std::atomic<int> wrong{0};
+    loads = 0;
+    for (round = 0; round < numRounds; ++round)
+    {
+      for (const auto &key : keys)
+      {
+        sharded.Remove(key); // Every key expires at once
+      }
+      std::vector<std::thread> workers;
+      for (int t = 0; t < numThreads; ++t)
+      {
+        workers.emplace_back([&, t]() {
+          for (int i = 0; i < callsPerThread; ++i)
+          {
+            int k = (t + i) % numKeys;
+            if (get(sharded, keys[k]) != round * 100 + k)
+            {
+              ++wrong;
+            }
+          }
+        });
+      }
+      for (auto &worker : workers)
+      {
+        worker.join();
+      }
+    }
+    return std::make_pair(loads.load(), wrong.load());
+  };
+
+  auto singleFlight = run([&](ShardedPriorityExpiryCache &sharded, const std::string &key) {
+    return sharded.GetOrLoad(key, loader, 1, 1000);
+  });
+  auto naive = run([&](ShardedPriorityExpiryCache &sharded, const std::string &key) {
+    CacheData value;
+    if (!sharded.Get(key, value))
     {
-      CacheItem oldItem = cache[key];
+      value = loader(key);
+      sharded.Set(key, value, 1, 1000);
+    }
+    return value;
+  });
+  std::cout << "Single flight (" << numThreads << " threads, " << numKeys << " keys, " << numRounds
+            << " rounds): GetOrLoad " << singleFlight.first << " loads, Get then Set " << naive.first << " loads, "
+            << singleFlight.second + naive.second << " wrong values" << std::endl;
+
+  return 0;
+}
 
-      // Evict the old item first
-      auto &lruList = priorityLRU[oldItem.priority];
-      lruList.erase(cacheItemLRUMap[key]);  // Remove from LRU list
-      cacheItemLRUMap.erase(key);           // Remove from the LRU map
-      expirySet.erase(oldItem);             // Remove from expiry set
-      cache.erase(key);                     // Remove from cache
-      
-      // If all items for this priority have been removed, delete the priority from the queue
-      if (lruList.empty())
+// Refresh-ahead: 5 hot keys read every simulated second for 100 s with a
+// 10 s TTL, next to 5 cold keys set once. Without a window every expiry
+// makes a reader wait for the loader; with a 20% window the hot keys are
+// reloaded in the background and only the cold ones expire.
+int refreshtest()
+{
+  const int numHot = 5;
+  const int numCold = 5;
+  const int ttl = 10;
+  const int numSeconds = 100;
+
+  std::thread::id caller = std::this_thread::get_id();
+  std::atomic<int> blocking{0};
+  std::atomic<int> background{0};
+  auto loader = [&](std::string_view) {
+    (std::this_thread::get_id() == caller ? blocking : background).fetch_add(1);
+    return static_cast<CacheData>(g_Time); // When it was loaded
+  };
+
+  auto run = [&](double refreshAhead, int &stale) {
+    CacheOptions options;
+    options.refreshAhead = refreshAhead;
+    ShardedPriorityExpiryCache sharded(1000, 4, options);
+    sharded.SetRefreshLoader(loader);
+    blocking = 0;
+    background = 0;
+    stale = 0;
+    for (int i = 0; i < numCold; ++i)
+    {
+      sharded.Set("Cold" + std::to_string(i), g_Time, 1, ttl);
+    }
+    for (int second = 0; second < numSeconds; ++second)
+    {
+      for (int i = 0; i < numHot; ++i)
       {
-        priorityQueue.erase(oldItem.priority);
-        priorityLRU.erase(oldItem.priority); // Clean up empty priority
+        CacheData loadedAt = sharded.GetOrLoad("Hot" + std::to_string(i), loader, 1, ttl);
+        if (loadedAt + ttl < g_Time) // Live through its deadline, as in isExpired
+        {
+          ++stale;
+        }
       }
+      sharded.WaitForRefreshes(); // The pool reads g_Time too
+      g_Time += 1;
     }
+    sharded.EnforceCapacity(); // Drops the expired entries
+    return sharded.Size();
+  };
 
-    // Insert the new item into cache and tracking structures
-    CacheItem newItem(key, value, priority, g_Time + expiryInSecs, g_Time);
+  int stale[2];
+  size_t plainSize = run(0, stale[0]);
+  int plainBlocking = blocking.load();
+  size_t refreshSize = run(0.2, stale[1]);
 
-    // Add this priority to the priorityQueue if not already present
-    if (priorityQueue.find(priority) == priorityQueue.end())
+  // One key read inside its window, by Get or MultiGet, whose reload (the
+  // value -1) is held until during() has run. Returns what a Get finds then.
+  auto reloadAround = [&](bool multiGet, const std::function<void(ShardedPriorityExpiryCache &)> &during) {
+    CacheOptions options;
+    options.refreshAhead = 0.2;
+    ShardedPriorityExpiryCache sharded(10, 1, options);
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    sharded.SetRefreshLoader([released](std::string_view) {
+      released.wait();
+      return static_cast<CacheData>(-1);
+    });
+    sharded.Set("Key", 1, 1, ttl);
+    g_Time += ttl - 1;
+    CacheData value = 0;
+    if (multiGet)
     {
-      priorityQueue.insert(priority);
+      std::string_view key = "Key";
+      bool found;
+      sharded.MultiGet(&key, 1, &value, &found);
     }
+    else
+    {
+      sharded.Get("Key", value);
+    }
+    during(sharded);
+    release.set_value();
+    sharded.WaitForRefreshes();
+    value = 0;
+    sharded.Get("Key", value);
+    return value;
+  };
+  auto nothing = [](ShardedPriorityExpiryCache &) {};
 
-    // Insert the item into its priority LRU list and map
-    auto &lruList = priorityLRU[priority];
-    lruList.push_front(key);                // Add to the front of the LRU list
-    cacheItemLRUMap[key] = lruList.begin(); // Map the key to the list iterator
-    expirySet.insert(newItem);
-    cache[key] = newItem;
+  // A Set or Remove while the reload runs wins over it; a reload that
+  // outlives the entry's TTL is still stored
+  int lostWrites = 0;
+  int lostReloads = 0;
+  lostWrites += reloadAround(false, [](ShardedPriorityExpiryCache &sharded) { sharded.Set("Key", 2, 1, ttl); }) != 2;
+  lostWrites += reloadAround(false, [](ShardedPriorityExpiryCache &sharded) { sharded.Remove("Key"); }) != 0;
+  lostReloads += reloadAround(false, nothing) != -1;
+  lostReloads += reloadAround(true, nothing) != -1;
+  lostReloads += reloadAround(false, [](ShardedPriorityExpiryCache &sharded) {
+    g_Time += ttl; // Expired, and reclaimed by this Get
+    CacheData value;
+    sharded.Get("Key", value);
+  }) != -1;
 
-    EvictItems(); // Evict if needed after adding new item
-  }
+  std::cout << "Refresh ahead (" << numHot << " hot keys read every second, TTL " << ttl << " s, " << numSeconds
+            << " s): no window " << plainBlocking << " blocking loads, 20% window " << blocking.load()
+            << " blocking and " << background.load() << " background loads; " << plainSize << " and " << refreshSize
+            << " entries left, " << stale[0] + stale[1] << " expired values served, " << lostWrites
+            << " writes lost to a reload, " << lostReloads << " reloads lost" << std::endl;
 
-  // Set the max cache size and evict items accordingly
-  void SetMaxItems(int numItems)
+  return 0;
+}
+
+// Save a 1M-entry cache, reload it into a fresh one, and check that both
+// evict exactly the same entries afterwards. The plain read of the file is
+// the floor for the load time.
+int snapshottest()
+{
+  const int numEntries = 1000000;
+  const int numPrioritys = 20;
+  const char *path = "priority-expiry-cache.snapshot";
+
+  std::vector<std::string> keyNames;
+  for (int i = 0; i < numEntries; ++i)
   {
-    maxItems = numItems;
-    EvictItems();
+    keyNames.push_back("Key" + std::to_string(i));
   }
-
-  // Evict expired items and low-priority items if the cache exceeds max size
-  void EvictItems()
+  std::mt19937 rng(1);
+  PriorityExpiryCache c(numEntries);
+  for (int i = 0; i < numEntries; ++i)
   {
-    // std::cout << 41 << std::endl;
-    // Evict expired items using the expirySet
-    while (!expirySet.empty() && (*expirySet.begin()).isExpired())
+    c.Set(keyNames[i], i, rng() % numPrioritys, rng() % 10000);
+    if (i % 1000 == 0)
     {
-      CacheItem expiredItem = *expirySet.begin();
-      expirySet.erase(expirySet.begin()); // Remove from expiry set
-
-      priorityLRU[expiredItem.priority].erase(cacheItemLRUMap[expiredItem.key]); // Remove from LRU tracking
-      cache.erase(expiredItem.key);                                              // Remove from cache
-      cacheItemLRUMap.erase(expiredItem.key);                                    // Remove from the LRU map
+      g_Time += 1;
     }
+  }
+  for (int i = 0; i < numEntries / 4; ++i)
+  {
+    c.Get(keyNames[rng() % numEntries]); // Shuffle the LRU order
+  }
+
+  std::cout << "Start snapshot test (" << c.Size() << " entries)..." << std::endl;
+  auto start = std::chrono::high_resolution_clock::now();
+  bool saved = c.SaveSnapshot(path);
+  std::chrono::duration<double> duration = std::chrono::high_resolution_clock::now() - start;
+  struct stat st;
+  stat(path, &st);
+  std::cout << "SaveSnapshot " << (saved ? "took: " : "FAILED after: ") << duration.count() << " seconds ("
+            << st.st_size / 1000000 << " MB)" << std::endl;
+
+  g_Time += 100; // The restart takes a while; some entries expire meanwhile
+  PriorityExpiryCache restored(numEntries);
+  start = std::chrono::high_resolution_clock::now();
+  bool loaded = restored.LoadSnapshot(path);
+  duration = std::chrono::high_resolution_clock::now() - start;
+  std::cout << "LoadSnapshot " << (loaded ? "took: " : "FAILED after: ") << duration.count() << " seconds ("
+            << restored.Size() << " live entries)" << std::endl;
+
+  start = std::chrono::high_resolution_clock::now();
+  FILE *file = fopen(path, "rb");
+  std::vector<char> chunk(1 << 20);
+  size_t bytes = 0;
+  while (size_t n = fread(chunk.data(), 1, chunk.size(), file))
+  {
+    bytes += n;
+  }
+  fclose(file);
+  duration = std::chrono::high_resolution_clock::now() - start;
+  std::cout << "Reading the file took: " << duration.count() << " seconds (" << bytes / 1000000 << " MB)" << std::endl;
+  remove(path);
+
+  // Same survivors after shrinking both caches to a third
+  c.SetMaxItems(numEntries / 3);
+  restored.SetMaxItems(numEntries / 3);
+  std::vector<std::string> before, after;
+  c.ForEachKey([&before](const std::string &key) { before.push_back(key); });
+  restored.ForEachKey([&after](const std::string &key) { after.push_back(key); });
+  std::sort(before.begin(), before.end());
+  std::sort(after.begin(), after.end());
+  std::cout << "Evictions after restart " << (before == after ? "match" : "DIFFER") << " (" << after.size()
+            << " entries kept)" << std::endl;
+  return 0;
+}
 
-    // Evict items if the cache size exceeds maxItems
-    while (cache.size() > static_cast<size_t>(maxItems))
+// Values from 16 bytes to 64 KB under an item cap, a byte cap and both:
+// only the byte cap bounds memory whatever the value size mix is.
+int bytetest()
+{
+  typedef BasicPriorityExpiryCache<std::string, std::string> BlobCache;
+  const int numKeys = 20000;
+  const int numOps = 100000;
+
+  std::vector<std::string> keyNames;
+  for (int i = 0; i < numKeys; ++i)
+  {
+    keyNames.push_back("Key" + std::to_string(i));
+  }
+
+  auto run = [&](const char *name, int maxItems, size_t maxBytes) {
+    CacheOptions options;
+    options.maxBytes = maxBytes;
+    BlobCache c(maxItems, options);
+    std::mt19937 rng(1);
+    size_t maxCharge = 0;
+    for (int i = 0; i < numOps; ++i)
     {
-      // Find the lowest priority from the priorityQueue
-      int lowestPriority = *priorityQueue.begin();
+      size_t valueBytes = size_t(16) << (rng() % 13); // 16 B .. 64 KB
+      c.Set(keyNames[rng() % numKeys], std::string(valueBytes, 'x'), rng() % 20, 1000000);
+      maxCharge = std::max(maxCharge, c.TotalCharge());
+    }
+    std::cout << name << ": " << c.Size() << " entries, " << c.TotalCharge() / 1000000 << " MB charged, peak "
+              << maxCharge / 1000000 << " MB" << std::endl;
+  };
 
-      // Evict least used items of the lowest priority using LRU
-      auto &lruList = priorityLRU[lowestPriority];
+  std::cout << "Start byte budget test..." << std::endl;
+  run("Item cap 4000", 4000, 0);
+  run("Byte cap 32 MB", INT_MAX, 32000000);
+  run("Item cap 3000 + byte cap 32 MB", 3000, 32000000);
+  return 0;
+}
 
-      while (!lruList.empty() && cache.size() > static_cast<size_t>(maxItems))
-      {
-        std::string key = lruList.back(); // Least recently used item
-        CacheItem &item = cache[key];
+// A working set that fits, read steadily while a long scan of one-off keys
+// goes through the same priority. Plain LRU lets the scan flush the working
+// set; TinyLFU keeps the scan keys out because each is seen only once.
+int admissiontest()
+{
+  const int capacity = 1000;
+  const int scanLength = 50000;
 
-        // Evict the valid item
-        lruList.pop_back();         // Remove from LRU list
-        cacheItemLRUMap.erase(key); // Remove from the LRU map
-        expirySet.erase(item);      // Remove from expirySet
-        cache.erase(key);           // Remove from cache
-      }
+  std::vector<std::string> hotKeys, scanKeys;
+  for (int i = 0; i < capacity; ++i)
+  {
+    hotKeys.push_back("Hot" + std::to_string(i));
+  }
+  for (int i = 0; i < scanLength; ++i)
+  {
+    scanKeys.push_back("Scan" + std::to_string(i));
+  }
 
-      // If all items for this priority have been removed, delete the priority from the queue
-      if (priorityLRU[lowestPriority].empty())
+  auto run = [&](const char *name, Admission admission) {
+    CacheOptions options;
+    options.admission = admission;
+    PriorityExpiryCache c(capacity, options);
+    std::mt19937 rng(1);
+    auto readThrough = [&c](const std::string &key) {
+      if (c.Get(key) == nullptr)
       {
-        priorityLRU.erase(lowestPriority); // Clean up empty priority
-        priorityQueue.erase(priorityQueue.begin());
+        c.Set(key, 1, 5, 1000000);
+        return false;
       }
+      return true;
+    };
+    for (int i = 0; i < 4 * capacity; ++i)
+    {
+      readThrough(hotKeys[rng() % capacity]);
+    }
+    int hits = 0;
+    for (int i = 0; i < scanLength; ++i)
+    {
+      readThrough(scanKeys[i]);
+      hits += readThrough(hotKeys[rng() % capacity]);
     }
+    int kept = 0;
+    for (const std::string &key : hotKeys)
+    {
+      kept += c.Get(key) != nullptr;
+    }
+    std::cout << name << ": hot hit ratio during scan " << static_cast<double>(hits) / scanLength << ", "
+              << kept << " of " << capacity << " hot keys kept" << std::endl;
+  };
+
+  std::cout << "Start admission test (scan of " << scanLength << " keys)..." << std::endl;
+  run("LRU", Admission::Always);
+  run("TinyLFU", Admission::TinyLFU);
+  return 0;
+}
+
+// Every entry that leaves a sharded cache fed by four threads is spilled
+// to a file through one WriteBehind; the file's per-reason counts must
+// match the caches' own eviction counters. Half the shards use TinyLFU, so
+// writes the admission filter turns away have to be spilled too.
+int writebehindtest()
+{
+  typedef WriteBehind<std::string, CacheData, FileEvictionSink> Spill;
+  typedef BasicPriorityExpiryCache<std::string, CacheData, KeyTraits<std::string>::DefaultHash, GlobalClock,
+                                   CacheLatencyStats, DefaultWeigher, WriteBehindListener<Spill>>
+      SpillingCache;
+  const char *path = "priority-expiry-cache.evictions";
+  const int numThreads = 4;
+  const int numRounds = 10; // The clock moves 100 s between rounds, while no thread runs
+  const int opsPerRound = 10000;
+  const int numShards = 4;
+
+  std::cout << "Start write-behind test (" << numThreads << " threads)..." << std::endl;
+  g_Time = 0;
+  Spill spill(path);
+  std::vector<std::unique_ptr<SpillingCache>> caches;
+  for (int i = 0; i < numShards; ++i)
+  {
+    CacheOptions options;
+    options.admission = i % 2 ? Admission::TinyLFU : Admission::Always;
+    caches.emplace_back(new SpillingCache(2000, options, GlobalClock(), WriteBehindListener<Spill>{&spill}));
   }
+  std::vector<std::mutex> locks(numShards);
 
-  // Debug function to print all keys in the cache for debugging
-  void DebugPrintKeys()
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int round = 0; round < numRounds; ++round, g_Time += 100)
   {
-    std::vector<std::string> keys;
-    for (const auto &item : cache)
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; ++t)
     {
-      keys.push_back(item.first);
+      threads.emplace_back([&, t]() {
+        std::mt19937 rng(round * numThreads + t);
+        for (int i = 0; i < opsPerRound; ++i)
+        {
+          std::string key = "Key" + std::to_string(rng() % 20000);
+          size_t shard = PriorityExpiryCache::HashKey(key) % numShards;
+          std::lock_guard<std::mutex> lock(locks[shard]);
+          if (i % 50 == 0)
+          {
+            caches[shard]->Remove(key);
+          }
+          else
+          {
+            caches[shard]->Set(key, i, rng() % 10, 1 + rng() % 200);
+          }
+        }
+      });
     }
-    std::sort(keys.begin(), keys.end());
-    for (const auto &key : keys)
+    for (auto &thread : threads)
     {
-      std::cout << key << " ";
+      thread.join();
     }
-    std::cout << std::endl;
   }
-};
+  double setSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+  CacheLatencyStats stats;
+  for (auto &cache : caches)
+  {
+    cache->Clear();
+    stats.Merge(cache->GetStats());
+  }
+  spill.Flush();
 
-int loadtest()
-{
-  // Load test
-  const int numOps = 300000;
-  const int numKeys = 10000;      // Number of unique keys to be used for Set operations
-  const int numPrioritys = 20;    // Number of unique keys to be used for Set operations
-  const int numCacheSize = 10000; // Number of unique keys to be used for Set operations
+  bool match = spill.GetSink().Good();
+  uint64_t total = 0;
+  std::cout << "Spilled:";
+  for (int r = 0; r < static_cast<int>(EvictReason::Count); ++r)
+  {
+    EvictReason reason = static_cast<EvictReason>(r);
+    match = match && stats.Evictions(reason) == spill.GetSink().Count(reason);
+    total += spill.GetSink().Count(reason);
+    std::cout << " " << EvictReasonName(reason) << " " << spill.GetSink().Count(reason);
+  }
+  std::cout << std::endl;
+  const LatencyHistogram &updates = stats.Histogram(CacheOp::SetUpdate);
+  std::cout << "Writes took: " << setSeconds << " seconds, Set (update) p50 " << updates.Percentile(0.5) << " ns, p99 "
+            << updates.Percentile(0.99) << " ns; file " << (match ? "matches" : "DIFFERS from")
+            << " the eviction counters (" << total << " lines)" << std::endl;
+  caches.clear();
+  std::remove(path);
+  return 0;
+}
 
-  // Initialize the cache with a maximum of items
-  PriorityExpiryCache c(numCacheSize); // Use a larger cache size for load testing
+// Read-through over 20x more keys than fit in memory, with and without the
+// disk tier. Every value is its own expiry time, so an expired entry served
+// from either tier would show up.
+int tieredtest()
+{
+  const int capacity = 10000;
+  const int numKeys = 20 * capacity;
+  const int numOps = 1000000;
 
-  // Measure time for Set operations
-  std::cout << "Start loading cache..." << std::endl;
-  auto start = std::chrono::high_resolution_clock::now();
-  for (int i = 0; i < numOps; ++i)
+  std::vector<std::string> keyNames;
+  for (int i = 0; i < numKeys; ++i)
   {
-    std::string key = "Key" + std::to_string(rand() % numKeys);
-    CacheData value = rand() % 100;
-    int priority = rand() % numPrioritys;
-    int expiryTime = rand() % 50;
-    c.Set(key, value, priority, expiryTime);
-    g_Time += 1; // Simulate the passage of time
+    keyNames.push_back("Key" + std::to_string(i));
   }
-  auto end = std::chrono::high_resolution_clock::now();
-  std::chrono::duration<double> duration = end - start;
-  std::cout << "Set operations took: " << duration.count() << " seconds" << std::endl;
 
-  // Measure time for Get operations
-  start = std::chrono::high_resolution_clock::now();
-  for (int i = 0; i < numOps; ++i)
+  auto run = [&](const char *name, auto &cache, auto get) {
+    g_Time = 0;
+    std::mt19937 rng(1);
+    int hits = 0, expiredServed = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numOps; ++i)
+    {
+      if (i % 100 == 0)
+      {
+        ++g_Time;
+      }
+      const std::string &key = keyNames[rng() % numKeys];
+      CacheData value;
+      if (get(key, value))
+      {
+        ++hits;
+        expiredServed += value < g_Time;
+      }
+      else
+      {
+        int ttl = 1 + rng() % 3600;
+        cache.Set(key, g_Time + ttl, rng() % 10, ttl);
+      }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << name << ": hit ratio " << static_cast<double>(hits) / numOps << ", " << expiredServed
+              << " expired served, " << seconds << " seconds" << std::endl;
+  };
+
+  std::cout << "Start tiered test (" << numKeys << " keys, " << capacity << " in memory)..." << std::endl;
+  PriorityExpiryCache memoryOnly(capacity);
+  run("Memory only", memoryOnly, [&](const std::string &key, CacheData &value) {
+    CacheData *found = memoryOnly.Get(key);
+    return found != nullptr && (value = *found, true);
+  });
+  TieredPriorityExpiryCache tiered(capacity, "priority-expiry-cache.tier", size_t(64) << 20, CacheOptions(),
+                                   GlobalClock(), size_t(4) << 20);
+  run("Memory + disk", tiered, [&](const std::string &key, CacheData &value) { return tiered.Get(key, value); });
+  const auto &counters = tiered.GetDisk().GetCounters();
+  std::cout << "Disk: " << tiered.GetDisk().Size() << " entries in " << tiered.GetDisk().Bytes() / 1000 << " KB, "
+            << counters.demoted << " demoted, " << counters.promoted << " promoted, " << counters.expired
+            << " expired, " << counters.compactions << " segments compacted" << std::endl;
+  return 0;
+}
+
+// What reading the time costs: steady_clock on every call against the
+// cached CoarseClock, alone and under a Get-heavy loop
+int clocktest()
+{
+  const int numReads = 10000000;
+  const int numKeys = 10000;
+  const int numGets = 3000000;
+
+  auto perRead = [&](auto now) {
+    CacheTime sum = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numReads; ++i)
+    {
+      sum += now();
+    }
+    std::chrono::duration<double, std::nano> duration = std::chrono::high_resolution_clock::now() - start;
+    return sum != 0 ? duration.count() / numReads : 0.0;
+  };
+  CoarseClock coarse;
+  double steadyNs = perRead([]() {
+    return static_cast<CacheTime>(std::chrono::steady_clock::now().time_since_epoch().count());
+  });
+  double coarseNs = perRead([&coarse]() { return coarse.Now(); });
+  std::cout << "Clock read: steady_clock " << steadyNs << " ns, CoarseClock " << coarseNs << " ns" << std::endl;
+
+  std::vector<std::string> keyNames;
+  for (int i = 0; i < numKeys; ++i)
   {
-    std::string key = "Key" + std::to_string(rand() % numKeys);
-    c.Get(key);
-    g_Time += 1; // Simulate the passage of time
+    keyNames.push_back("Key" + std::to_string(i));
   }
-  end = std::chrono::high_resolution_clock::now();
-  duration = end - start;
-  std::cout << "Get operations took: " << duration.count() << " seconds" << std::endl;
+  auto run = [&](const char *name, auto &cache) {
+    for (int i = 0; i < numKeys; ++i)
+    {
+      cache.Set(keyNames[i], i, i % 20, 3600);
+    }
+    int hits = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numGets; ++i)
+    {
+      hits += cache.Get(keyNames[i % numKeys]) != nullptr;
+    }
+    std::chrono::duration<double> duration = std::chrono::high_resolution_clock::now() - start;
+    std::cout << name << ": " << numGets << " Gets took " << duration.count() << " seconds (" << hits << " hits)"
+              << std::endl;
+  };
+  PriorityExpiryCache simulated(numKeys);
+  run("GlobalClock (seconds)", simulated);
+  BasicPriorityExpiryCache<std::string, CacheData, KeyTraits<std::string>::DefaultHash, CoarseClock> real(numKeys);
+  run("CoarseClock (milliseconds)", real);
+  return 0;
+}
 
-  // Load Test: Evictions - Simulating repeated eviction pressures
+// Write tail latency with and without a reap budget. Every simulated second
+// a cohort of Sets arrives with the same short TTL, so whole cohorts expire
+// together; draining them all in the first Set of a second shows up as a
+// latency spike that a small per-write budget spreads out.
+int reaptest(size_t reapBudget)
+{
+  const int numSeconds = 200;
+  const int setsPerSecond = 10000;
+  const int ttl = 5;
 
-  std::cout << "Start eviction load test..." << std::endl;
-  start = std::chrono::high_resolution_clock::now();
-  for (int i = 0; i < numOps; ++i)
+  std::vector<std::string> keyNames;
+  for (int i = 0; i < numSeconds * setsPerSecond; ++i)
   {
-    // Force eviction by calling EvictItems frequently
-    c.EvictItems();
-    g_Time += 1; // Simulate the passage of time
+    keyNames.push_back("Key" + std::to_string(i));
+  }
 
-    // Optionally, periodically add new items to the cache during eviction cycles
-    if (i % 100 == 0) // For example, add a new item every 100 eviction cycles
+  CacheOptions options;
+  options.reapBudget = reapBudget;
+  ManualClock clock;
+  BasicPriorityExpiryCache<std::string, CacheData, KeyTraits<std::string>::DefaultHash, ManualClock> c(
+      numSeconds * setsPerSecond, options, clock);
+
+  std::vector<double> latencies;
+  latencies.reserve(keyNames.size());
+  for (int second = 0; second < numSeconds; ++second)
+  {
+    c.GetClock().Advance(1);
+    for (int i = 0; i < setsPerSecond; ++i)
     {
-      std::string key = "Key" + std::to_string(rand() % numKeys);
-      CacheData value = rand() % 100;
-      int priority = rand() % numPrioritys;
-      int expiryTime = rand() % 50;
-      c.Set(key, value, priority, expiryTime);
+      auto start = std::chrono::high_resolution_clock::now();
+      c.Set(keyNames[second * setsPerSecond + i], i, i % 20, ttl);
+      std::chrono::duration<double, std::nano> duration = std::chrono::high_resolution_clock::now() - start;
+      if (second > 2 * ttl) // Skip warm-up, while the table and pool still grow
+      {
+        latencies.push_back(duration.count());
+      }
     }
   }
-  end = std::chrono::high_resolution_clock::now();
-  duration = end - start;
-  std::cout << "Eviction load test took: " << duration.count() << " seconds" << std::endl;
-
-  // Optionally, debug the final state of cache keys
-  // std::cout << "Final cache keys: ";
-  // c.DebugPrintKeys();
 
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double q) { return latencies[static_cast<size_t>(q * (latencies.size() - 1))]; };
+  std::cout << "Reap budget " << reapBudget << ": Set p50 " << static_cast<long>(percentile(0.5))
+            << " ns, p99 " << static_cast<long>(percentile(0.99)) << " ns, p999 " << static_cast<long>(percentile(0.999))
+            << " ns, max " << static_cast<long>(latencies.back()) << " ns, "
+            << latencies.end() - std::upper_bound(latencies.begin(), latencies.end(), 100000.0) << " Sets over 100 us" << std::endl;
   return 0;
 }
 
+// Worst single insert while growing from empty to 10M entries. The
+// std::unordered_map the cache started out with rehashes every element
+// inside the insert that crosses its load factor; the cache's index moves
+// a few groups per write instead, and the expiry heap (or wheel) only ever
+// adds a block.
+int growtest()
+{
+  const int numKeys = 10000000;
+  char buffer[32];
+  auto keyOf = [&buffer](int i) { return std::string_view(buffer, snprintf(buffer, sizeof(buffer), "Key%d", i)); };
+
+  auto run = [&](const char *name, auto insert) {
+    double worst = 0;
+    int slow = 0;
+    auto begin = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numKeys; ++i)
+    {
+      std::string_view key = keyOf(i);
+      auto start = std::chrono::high_resolution_clock::now();
+      insert(key, i);
+      std::chrono::duration<double, std::micro> duration = std::chrono::high_resolution_clock::now() - start;
+      worst = std::max(worst, duration.count());
+      slow += duration.count() > 100;
+    }
+    std::chrono::duration<double> total = std::chrono::high_resolution_clock::now() - begin;
+    std::cout << name << ": " << total.count() << " seconds, worst insert " << static_cast<long>(worst) << " us, "
+              << slow << " inserts over 100 us" << std::endl;
+  };
+
+  std::cout << "Start growth test (" << numKeys << " keys)..." << std::endl;
+  {
+    CacheOptions options;
+    options.densePriorities = 20;
+    PriorityExpiryCache c(numKeys, options);
+    run("PriorityExpiryCache (heap)", [&c](std::string_view key, int i) { c.Set(key, i, i % 20, 3600); });
+  }
+  {
+    CacheOptions options;
+    options.expiryIndex = ExpiryIndex::TimingWheel;
+    options.densePriorities = 20;
+    PriorityExpiryCache c(numKeys, options);
+    run("PriorityExpiryCache (wheel)", [&c](std::string_view key, int i) { c.Set(key, i, i % 20, 3600); });
+  }
+  {
+    // Last: freeing its 10M small nodes leaves malloc a long consolidation
+    // to do in whatever allocates next
+    std::unordered_map<std::string, CacheData> map;
+    run("std::unordered_map", [&map](std::string_view key, int i) { map.emplace(key, i); });
+  }
+  return 0;
+}
 
 int main() {
   PriorityExpiryCache c(5);
@@ -339,7 +5741,38 @@ int main() {
   // "E" is removed because C is more recently used (due to the Get("C") event).
   c.DebugPrintKeys();
 
-  loadtest();
+  typedtest();
+  movetest();
+
+  // A/B the expiry indexes and priority layouts: short TTLs keep the live
+  // set tiny, long TTLs keep the cache full and evicting by priority
+  CacheOptions options;
+  for (int ttl : {50, 100000})
+  {
+    options.densePriorities = 0;
+    options.expiryIndex = ExpiryIndex::Heap;
+    loadtest(options, ttl);
+    options.expiryIndex = ExpiryIndex::TimingWheel;
+    loadtest(options, ttl);
+    options.densePriorities = 20;
+    loadtest(options, ttl);
+  }
+  std::cout << "Instrumented: ";
+  loadtest<InstrumentedPriorityExpiryCache>(options, 100000);
+  batchtest();
+  snapshottest();
+  bytetest();
+  admissiontest();
+  writebehindtest();
+  tieredtest();
+  clocktest();
+  reaptest(0);
+  reaptest(2);
+  growtest();
+  concurrentLoadtest();
+  readMixtest();
+  singleflighttest();
+  refreshtest();
 
   return 0;
 }
@@ -347,16 +5780,177 @@ int main() {
 // 1. priorityqueue 用的是红黑树(std::set)，并且只保存priority integer。
 // 2. lruList linkedlist ，用了局部变量，对每一个单独操作提高了 map 的速度。
 // 3. Get 的时间复杂度是 O(1)，Set 的是 O(logn) , Evict 是渐进式 O(logn)
+// 4. 每个 entry 只有一个 Node（池化分配），key 只存一份；hash 索引、LRU 链表、expiry heap 都只存 Node 指针或是侵入式的。
+// 5. expiry 索引可选 heap 或分层 timing wheel（64 槽 x 4 层），wheel 的插入/取消/过期都是均摊 O(1)。
+// 6. densePriorities 模式下，priority 用固定数组 + 两级 bitmap，找最低 priority 是两次 ctz，O(1)；范围外的仍走 std::set。
+// 7. BasicPriorityExpiryCache<Key, Value, Hash, Clock> 模板化；PriorityExpiryCache 是 <std::string, int> 的别名。
+//    trivially copyable 的 key 按值传递、不存 hash；时钟是每个 cache 自己的成员，不再直接读 g_Time。
+// 8. Get 碰到过期 entry 直接回收（lazy expiry）；reapBudget > 0 时每次写最多额外回收这么多过期 entry，
+//    不再在一次 Set 里清空整批同时过期的 entry，尾延迟更平；ReapExpired(budget) 可以由后台定期调用。
+// 9. Stats 模板参数：默认 NullCacheStats 什么都不做（连时钟都不读）；CacheLatencyStats 按操作记 log-bucket
+//    延迟直方图（误差 < 1/16），并按原因（过期 / 容量）统计 eviction，可输出文本和 JSON。
+// 10. SaveSnapshot/LoadSnapshot：每个 priority 从 LRU 尾到头顺序写出，mmap 读回时按原顺序 PushFront，
+//     重启后淘汰顺序完全一致；加载时跳过已过期的，先建完所有 node，再一次性建索引（表一次分配并预先缺页、
+//     插入不做迁移和增长检查）、在 (expiryTime, node) 数组上 O(n) 建堆。仍是 CPU 瓶颈，约 0.2 s / 1M 条。
+// 11. maxBytes：每个 entry 的 charge = node 大小 + Weigher(key, value)，写入/更新时 O(1) 调整 totalCharge，
+//     淘汰直到条目数和字节数都满足；charge 存在 node 原来的 padding 里，不增加内存。
+// 12. Recency::Clock：Get 命中只置 referenced 位（已置位就不写），不动链表；淘汰时尾部被引用过的清位挪到头部
+//     （second chance）。bench 里 homework-clock 和 homework 的命中率差别在 0.1% 以内。
+// 13. Admission::TinyLFU：count-min sketch（4 行 4-bit 计数器，约 2 字节/entry，每 10 x 容量次计数减半）记录
+//     Get/Set 的频率；缓存满、没有过期 entry、并且新 key 和要被淘汰的尾部同一个 priority 时，新 key 频率更高才放进来。
+//     被拒绝的写入按 EvictReason::Rejected 计数并交给 listener，写回和磁盘层都不会丢。
+//     过期优先、低 priority 优先的规则不变。单 priority 的 scan 负载命中率提高约 2 个点，热点集合突然切换时会变差，所以默认关闭。
+// 14. Listener 模板参数：entry 离开缓存时（expired / capacity / replaced / explicit / rejected）把 key 和 value move 给 listener；
+//     默认 NullEvictionListener 编译期去掉。WriteBehindListener 推进 Vyukov MPSC 无锁队列，后台线程写到 Sink，
+//     Set 只做一次分配和一次原子交换，不等 I/O；FileEvictionSink 每行写 "reason key value"，用来测试。
+// 15. TieredPriorityExpiryCache：因容量被淘汰或没被准入的 entry（不含过期的）带着 priority 和 expiry 降级到 DiskTier；
+//     DiskTier 是追加写的分段日志（写缓冲攒满 64 KB 一次 pwrite）加内存 hash 索引，Get 在内存 miss 后查磁盘并提升回内存。
+//     磁盘上读之前先比 expiry，过期的永远不返回；大半是垃圾的段会被压缩，超出 maxBytes 时按降级先后丢最老的段。
+// 16. 时间改成 int64 的 clock tick（CacheTime），Clock 声明 kTicksPerSecond；TTL 参数仍是整秒，进来时换算成 tick。
+//     CoarseClock 由一个 ticker 线程每 1 ms 读一次 steady_clock 存进 atomic，热路径只做一次 relaxed load，
+//     isExpired() 还是一次比较；ManualClock 改成毫秒给测试用，timing wheel 的层数按 tick 频率算（毫秒 6 层）。
+// 17. hash 索引从拉链表换成 Swiss-table 式的开放寻址：每组正好一个 cache line（7 个控制字节 + 1 个 overflow 字节
+//     + 7 个 Node 指针），SSE2 一次比较 7 个 7-bit tag，命中只碰组所在的那一行和 Node；overflow 位让 miss 大多一行结束，
+//     删除不需要墓碑。Node 少了 hashNext 指针，省下的 8 字节基本被更空的表抵掉，每个 entry 内存持平。
+//     和仍用 std::unordered_map 的 gem2exp / interviewing 并排比见 tesla20250120-bench.cc：1M key、10 万容量时
+//     get_hit p50 223 ns 对 479 / 335 ns，每 entry 124 B 对 261 / 165 B（bench 的内存数从计入 mmap 的索引起才准）。
+// 18. 索引扩容改成渐进式：新表用 mmap 拿零页（分配是 O(1)），之后每次 Insert/Erase 只搬旧表 2 个组，
+//     查找在搬完之前两张表都查（旧表里已搬走的组直接跳过），旧表搬空的部分每 64 KB munmap 一次。
+//     expiry heap 的数组也改成 32 KB 一块的 BlockArray，扩容只加一块、不搬已有的。
+//     growtest 从空长到 1000 万 key（heap 和 wheel 各一次）：std::unordered_map 最慢的一次插入在 1 秒左右，
+//     cache 的最慢一次只是调度噪声。
+// 19. ReadMode::LockFree：分片缓存的 Get 不拿锁。写者在锁内把分片的 seqlock 版本号改成奇数再改数据，读者读完再核对版本号，
+//     变了就重试，4 次不成功退回拿锁。被删掉的 Node 和旧索引表用 epoch 延迟释放，读者还在时不会被复用或 munmap；
+//     命中记进按线程分条的环形缓冲区，下一个写者（或缓冲区半满时抢到锁的读者）在锁内批量回放成 LRU 更新，满了就丢。
+//     只支持可平凡复制的 value；单核机器上只看得出多出来的簿记开销，真正的收益要多核才有。
+// 20. GetOrLoad(key, loader, priority, ttl)：分片缓存 miss 后，同一个 key 的并发请求只让第一个调用 loader，
+//     其余的拿到同一个 shared_future 等结果（GetOrLoadShared 直接把 future 交出去，不阻塞）；loader 在锁外跑，
+//     写入缓存和撤掉"加载中"记录在同一个临界区里完成。loader 抛异常时所有等待者都收到异常，缓存里不写。
+// 21. Refresh-ahead：CacheOptions::refreshAhead 是 TTL 的比例（0 关闭）。节点记下上次写入时的 TTL（uint32 tick，
+//     饱和），Get 命中时剩余时间不超过 ttl * refreshAhead 就报告"该刷新了"。分片缓存配了 SetRefreshLoader 后，
+//     把 key 交给 WorkerPool 在后台加载，用原来的优先级和 TTL SetUntil 回去，期间读者照样拿旧值；
+//     和 GetOrLoad 共用 loading 表，同一个 key 同时只加载一次。窗口里没人读的 key 照常过期，由 EvictItems 回收。
+//     节点上的 refreshing 标记保证窗口里只有第一次命中去调度（之后的命中只读一下标记，无锁无分配）；
+//     加载期间 key 被 Set 或 Remove 过（loading 表里记下 written）就丢弃加载结果，新的写入为准；
+//     只是过期被回收了的照样写回。只有带 Refresh 的 Get/MultiGet 才会认领刷新，普通 Get 不碰标记。
 
-// g++ -std=c++11 tesla20250120-homework.cc -o a && ./a
+// g++ -std=c++17 -O2 -pthread tesla20250120-homework.cc -o a && ./a
 
 // A B C D E
 // A C D E
 // A C E
 // C E
 // C
-// Start loading cache...
-// Set operations took: 0.888077 seconds
-// Get operations took: 0.0451756 seconds
+// Blob 1 expired, blob 2 present, counter 42 present
+// Counter 42 present at 10.000 s, expired at 10.001 s
+// Emplace new key: 1 constructed, 0 copied, 0 moved
+// Emplace existing key: 1 constructed, 0 copied, 0 moved
+// Set rvalue: 1 constructed, 0 copied, 1 moved
+// Set lvalue over existing key: 0 constructed, 1 copied, 0 moved
+// Emplace that throws over A: A removed, size 1
+// Start loading cache (heap, sparse priorities, TTL < 50s)...
+// Set operations took: 0.117773 seconds
+// Get operations took: 0.01454 seconds
+// Get operations (precomputed hash) took: 0.010071 seconds
+// Start eviction load test...
+// Eviction load test took: 0.00185148 seconds
+// Memory per entry: 154 bytes (10000 entries)
+// Start loading cache (timing wheel, sparse priorities, TTL < 50s)...
+// Set operations took: 0.101766 seconds
+// Get operations took: 0.0140404 seconds
+// Get operations (precomputed hash) took: 0.00980742 seconds
+// Start eviction load test...
+// Eviction load test took: 0.00306708 seconds
+// Memory per entry: 144 bytes (10000 entries)
+// Start loading cache (timing wheel, dense priorities, TTL < 50s)...
+// Set operations took: 0.071846 seconds
+// Get operations took: 0.0115374 seconds
+// Get operations (precomputed hash) took: 0.0103482 seconds
+// Start eviction load test...
+// Eviction load test took: 0.0029573 seconds
+// Memory per entry: 144 bytes (10000 entries)
+// Start loading cache (heap, sparse priorities, TTL < 100000s)...
+// Set operations took: 0.0819344 seconds
+// Get operations took: 0.0175004 seconds
+// Get operations (precomputed hash) took: 0.00795964 seconds
+// Start eviction load test...
+// Eviction load test took: 0.00187828 seconds
+// Memory per entry: 154 bytes (10000 entries)
+// Start loading cache (timing wheel, sparse priorities, TTL < 100000s)...
+// Set operations took: 0.070456 seconds
+// Get operations took: 0.0189291 seconds
+// Get operations (precomputed hash) took: 0.0114588 seconds
+// Start eviction load test...
+// Eviction load test took: 0.00522162 seconds
+// Memory per entry: 144 bytes (10000 entries)
+// Start loading cache (timing wheel, dense priorities, TTL < 100000s)...
+// Set operations took: 0.0644581 seconds
+// Get operations took: 0.0147376 seconds
+// Get operations (precomputed hash) took: 0.00903778 seconds
+// Start eviction load test...
+// Eviction load test took: 0.00399674 seconds
+// Memory per entry: 144 bytes (10000 entries)
+// Instrumented: Start loading cache (timing wheel, dense priorities, TTL < 100000s)...
+// Set operations took: 0.109477 seconds
+// Get operations took: 0.0403198 seconds
+// Get operations (precomputed hash) took: 0.041546 seconds
 // Start eviction load test...
-// Eviction load test took: 0.0107144 seconds
+// Eviction load test took: 0.0347906 seconds
+// get_hit: count 40235, mean 104 ns, p50 95, p99 239, p999 447, max 773 ns
+// get_miss: count 559765, mean 54 ns, p50 43, p99 135, p999 271, max 1499369 ns
+// set_insert: count 40721, mean 261 ns, p50 207, p99 831, p999 6143, max 110920 ns
+// set_update: count 262279, mean 211 ns, p50 191, p99 463, p999 1279, max 32272 ns
+// evict_items: count 603000, mean 57 ns, p50 53, p99 191, p999 431, max 159375 ns
+// evictions: expired 40251, capacity 0, replaced 262279, explicit 0, rejected 0
+// {"latency_ns":{"get_hit":{"count":40235,"mean":104,"p50":95,"p90":151,"p99":239,"p999":447,"max":773},"get_miss":{"count":559765,"mean":54,"p50":43,"p90":67,"p99":135,"p999":271,"max":1499369},"set_insert":{"count":40721,"mean":261,"p50":207,"p90":335,"p99":831,"p999":6143,"max":110920},"set_update":{"count":262279,"mean":211,"p50":191,"p90":287,"p99":463,"p999":1279,"max":32272},"evict_items":{"count":603000,"mean":57,"p50":53,"p90":63,"p99":191,"p999":431,"max":159375}},"evictions":{"expired":40251,"capacity":0,"replaced":262279,"explicit":0,"rejected":0}}
+// Memory per entry: 144 bytes (10000 entries)
+// Start batch test (1000000 entries)...
+// Repeated key in one batch: same entry both times
+// scalar: Get 282.253 ns/op, Set 689.849 ns/op
+// batch 64: MultiGet 246.728 ns/op, MultiSet 392.715 ns/op (size 1000000)
+// batch 128: MultiGet 245.907 ns/op, MultiSet 383.777 ns/op (size 1000000)
+// batch 256: MultiGet 239.489 ns/op, MultiSet 376.294 ns/op (size 1000000)
+// batch 512: MultiGet 240.7 ns/op, MultiSet 379.735 ns/op (size 1000000)
+// Start snapshot test (949974 entries)...
+// SaveSnapshot took: 0.238382 seconds (35 MB)
+// LoadSnapshot took: 0.19287 seconds (939959 live entries)
+// Reading the file took: 0.00565859 seconds (35 MB)
+// Evictions after restart match (333333 entries kept)
+// Start byte budget test...
+// Item cap 4000: 4000 entries, 40 MB charged, peak 42 MB
+// Byte cap 32 MB: 3140 entries, 31 MB charged, peak 32 MB
+// Item cap 3000 + byte cap 32 MB: 3000 entries, 30 MB charged, peak 31 MB
+// Start admission test (scan of 50000 keys)...
+// LRU: hot hit ratio during scan 0.43616, 434 of 1000 hot keys kept
+// TinyLFU: hot hit ratio during scan 0.66406, 641 of 1000 hot keys kept
+// Start write-behind test (4 threads)...
+// Spilled: expired 37496 capacity 187588 replaced 149995 explicit 11056 rejected 5865
+// Writes took: 0.533537 seconds, Set (update) p50 543 ns, p99 4351 ns; file matches the eviction counters (392000 lines)
+// Start tiered test (200000 keys, 10000 in memory)...
+// Memory only: hit ratio 0.04998, 0 expired served, 0.489925 seconds
+// Memory + disk: hit ratio 0.44384, 0 expired served, 2.70849 seconds
+// Disk: 135872 entries in 8372 KB, 890858 demoted, 394321 promoted, 360665 expired, 7 segments compacted
+// Clock read: steady_clock 45.1119 ns, CoarseClock 0.688519 ns
+// GlobalClock (seconds): 3000000 Gets took 0.126166 seconds (3000000 hits)
+// CoarseClock (milliseconds): 3000000 Gets took 0.131455 seconds (3000000 hits)
+// Reap budget 0: Set p50 157 ns, p99 516 ns, p999 5540 ns, max 12178880 ns, 201 Sets over 100 us
+// Reap budget 2: Set p50 901 ns, p99 3385 ns, p999 16184 ns, max 2098529 ns, 51 Sets over 100 us
+// Start growth test (10000000 keys)...
+// PriorityExpiryCache (heap): 8.08559 seconds, worst insert 12857 us, 472 inserts over 100 us
+// PriorityExpiryCache (wheel): 8.30736 seconds, worst insert 13185 us, 692 inserts over 100 us
+// std::unordered_map: 12.1842 seconds, worst insert 1116420 us, 308 inserts over 100 us
+// Start concurrent load test (20% Set, 12 shards)...
+// 1 threads: global mutex 3509931 ops/sec, sharded 3964869 ops/sec (size 10008 -> 10000)
+// 2 threads: global mutex 4915749 ops/sec, sharded 4547312 ops/sec (size 10008 -> 10000)
+// 4 threads: global mutex 5256031 ops/sec, sharded 4756417 ops/sec (size 10008 -> 10000)
+// Start read mix test (5% Set, 12 shards)...
+// 1 threads: locked 7206162 ops/sec, lock-free 6820525 ops/sec (size 10000, 10000)
+// 2 threads: locked 7290550 ops/sec, lock-free 6643847 ops/sec (size 10000, 10000)
+// 4 threads: locked 6971758 ops/sec, lock-free 6064137 ops/sec (size 10000, 10000)
+// 8 threads: locked 6725959 ops/sec, lock-free 6249468 ops/sec (size 10000, 10000)
+// 16 threads: locked 6593622 ops/sec, lock-free 6106260 ops/sec (size 10000, 10000)
+// 32 threads: locked 6234736 ops/sec, lock-free 6053525 ops/sec (size 10000, 10000)
+// 64 threads: locked 5895995 ops/sec, lock-free 5003669 ops/sec (size 10000, 10000)
+// Single flight (16 threads, 10 keys, 20 rounds): GetOrLoad 200 loads, Get then Set 501 loads, 0 wrong values
+// Refresh ahead (5 hot keys read every second, TTL 10 s, 100 s): no window 50 blocking loads, 20% window 5 blocking and 60 background loads; 5 and 5 entries left, 0 expired values served, 0 writes lost to a reload, 0 reloads lost
+// (above from a 1-core sandbox; sharding only pays off with real cores)
@@ -39,73 +39,190 @@ Example:
 p5 => priority 5
 e10 => expires at 10 seconds since epoch
 
-保证 Get 的时间复杂度是 O(1)，Set 的是 O(n logn) , Evict 是渐进式 O(1)
+保证 Get 的时间复杂度是 O(1)，Set 的是 O(logn) , Evict 是每个 entry O(logn)
 */
 
 #include <iostream>
 #include <chrono>
 #include <thread>
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 int g_Time = 0;
 
 typedef int CacheData;
 
+// Array-backed D-ary min-heap of entry slots (uint32_t indexes into one
+// contiguous entry array, no pointers). Every entry keeps its own position
+// in the heap (Key::Index), so any entry can be removed or re-keyed in
+// O(log n), not just the top. D = 4 keeps the tree shallow and the
+// children of a node on one cache line.
+template <typename Entry, typename Key, int D = 4>
+class IndexedHeap {
+  std::vector<Entry>& entries;
+  std::vector<uint32_t> heap;
+
+public:
+  explicit IndexedHeap(std::vector<Entry>& entries) : entries(entries) {}
+
+  bool empty() const { return heap.empty(); }
+  uint32_t top() const { return heap[0]; }
+
+  void push(uint32_t slot) {
+    heap.push_back(slot);
+    SiftUp(heap.size() - 1);
+  }
+
+  void erase(uint32_t slot) {
+    size_t i = Key::Index(entries[slot]);
+    uint32_t last = heap.back();
+    heap.pop_back();
+    if (last != slot) {
+      Place(i, last);
+      SiftUp(i);
+      SiftDown(Key::Index(entries[last]));
+    }
+  }
+
+  // The entry's key changed in either direction
+  void update(uint32_t slot) {
+    SiftUp(Key::Index(entries[slot]));
+    SiftDown(Key::Index(entries[slot]));
+  }
+
+private:
+  bool Less(uint32_t a, uint32_t b) const { return Key::Less(entries[a], entries[b]); }
+
+  void Place(size_t i, uint32_t slot) {
+    heap[i] = slot;
+    Key::Index(entries[slot]) = static_cast<uint32_t>(i);
+  }
+
+  void SiftUp(size_t i) {
+    uint32_t slot = heap[i];
+    while (i > 0) {
+      size_t parent = (i - 1) / D;
+      if (!Less(slot, heap[parent])) {
+        break;
+      }
+      Place(i, heap[parent]);
+      i = parent;
+    }
+    Place(i, slot);
+  }
+
+  void SiftDown(size_t i) {
+    uint32_t slot = heap[i];
+    size_t n = heap.size();
+    for (;;) {
+      size_t first = i * D + 1;
+      if (first >= n) {
+        break;
+      }
+      size_t best = first;
+      for (size_t child = first + 1; child < std::min(first + D, n); ++child) {
+        if (Less(heap[child], heap[best])) {
+          best = child;
+        }
+      }
+      if (!Less(heap[best], slot)) {
+        break;
+      }
+      Place(i, heap[best]);
+      i = best;
+    }
+    Place(i, slot);
+  }
+};
+
 struct PriorityExpiryCache {
   int maxItems;
-  // TODO(interviewee): implement this
-  typedef DataKey string;
-  typedef DataValue int;
-  HashSet<DataKey, DataValue> values; // Get O(1)
-
-  // priority == 1
-  // 10000 elements: <p1, e10000>
-  // Get("A"). A
-  // Get("C"). A->C
-  // Get("B"). A->C->B
-  // Get("D"). A->C->B->D
-  // HashSet<Key, LinkedListPointer> pointerHash. 
-  // Get("A"). A->C->B->D <-- A's pointer = pointerHash["A"] O(1)
-  // Get("A"). C->B->D->A O(1)
-  // Evict(size=2),   BD, remove AC
-
-  std::map, std::unordered_set, set::
+  typedef std::string DataKey;
+  typedef CacheData DataValue;
 
-  struct PriorityKey {
-    int priority;
-    int lastTimeUsed; // replace with linkedlist
+  // One slot per entry in a contiguous array; the heaps and the hash index
+  // refer to entries by slot number. Freed slots are reused.
+  struct Entry {
     DataKey dataKey;
+    DataValue value;
+    int priority;
+    int expireTime;
+    long lastTimeUsed;                 // Bumped by Get/Set in O(1)
+    long heapTimeUsed;                 // lastTimeUsed when heapOfPriority last placed this entry
+    uint32_t index_of_priority_heap;   // Position in heapOfPriority
+    uint32_t index_of_expiration_heap; // Position in heapOfExpiration
   };
-  PriorityQueue<PriorityKey> heapOfPriority; // log(n)
-  // 在 PriorityQueue 内部，支持 delete 元素
-
-    // 1
-    // 1.  2
-    // 1 3.  2 4
-    // remove 1:
-    // 3
-    // 3.  2
-    // 4 3.  2 nil // O(log n)
-    // index_of[4] = 4
-    // index_of[1] = 7
 
+  // (priority, lastTimeUsed) min-heap. A Get only bumps lastTimeUsed; the
+  // heap still orders the entry by the older heapTimeUsed, which can only
+  // make it look less recently used than it is. EvictItems re-sifts a stale
+  // top before trusting it, so Get stays O(1).
+  struct PriorityKey {
+    static bool Less(const Entry& a, const Entry& b) {
+      return a.priority != b.priority ? a.priority < b.priority : a.heapTimeUsed < b.heapTimeUsed;
+    }
+    static uint32_t& Index(Entry& e) { return e.index_of_priority_heap; }
+  };
 
   struct ExpirationKey {
-    int expireTime;
-    DataKey dataKey;
+    static bool Less(const Entry& a, const Entry& b) { return a.expireTime < b.expireTime; }
+    static uint32_t& Index(Entry& e) { return e.index_of_expiration_heap; }
   };
-  PriorityQueue<ExpirationKey> heapOfExpiration;
 
+  std::vector<Entry> entries;
+  std::vector<uint32_t> freeSlots;
+  std::unordered_map<DataKey, uint32_t> values; // Get O(1)
+  IndexedHeap<Entry, PriorityKey> heapOfPriority{entries};     // log(n)
+  IndexedHeap<Entry, ExpirationKey> heapOfExpiration{entries}; // log(n)
+  long useCounter = 0;
+
+  PriorityExpiryCache(int max_items) : maxItems(max_items) {}
+  PriorityExpiryCache(const PriorityExpiryCache&) = delete; // The heaps point at entries
+  PriorityExpiryCache& operator=(const PriorityExpiryCache&) = delete;
 
-  
   CacheData* Get(std::string key) {
-    // ... the interviewee does not need to implement this now.
-    // Assume that this will return the value for the key in the cache
-    return nullptr;
+    auto it = values.find(key);
+    if (it == values.end()) {
+        return nullptr;
+    }
+    Entry& entry = entries[it->second];
+    if (entry.expireTime < g_Time) {
+        // expired
+        Remove(it->second);
+        return nullptr;
+    }
+    entry.lastTimeUsed = ++useCounter;
+    return &entry.value;
   }
   
   void Set(std::string key, CacheData value, int priority, int expiryInSecs) {
-    // ... the interviewee does not need to implement this now.
-    // Assume that this will add this key, value pair to the cache
+    auto it = values.find(key);
+    if (it != values.end()) {
+        // update existing entry, re-keying it in both heaps
+        uint32_t slot = it->second;
+        Entry& entry = entries[slot];
+        entry.value = value;
+        entry.priority = priority;
+        entry.lastTimeUsed = entry.heapTimeUsed = ++useCounter;
+        heapOfPriority.update(slot);
+        entry.expireTime = g_Time + expiryInSecs;
+        heapOfExpiration.update(slot);
+    } else {
+        // insert new entry
+        uint32_t slot = AllocateSlot();
+        Entry& entry = entries[slot];
+        entry.dataKey = key;
+        entry.value = value;
+        entry.priority = priority;
+        entry.expireTime = g_Time + expiryInSecs;
+        entry.lastTimeUsed = entry.heapTimeUsed = ++useCounter;
+        values.emplace(std::move(key), slot);
+        heapOfPriority.push(slot);
+        heapOfExpiration.push(slot);
+    }
     EvictItems();
   }
   
@@ -115,12 +232,53 @@ struct PriorityExpiryCache {
   }
   
   void DebugPrintKeys() {
-    // ... the interviewee does not need to implement this now.
-    // Prints all the keys in the cache for debugging purposes
+    std::vector<DataKey> keys;
+    for (const auto& item : values) {
+        keys.push_back(item.first);
+    }
+    std::sort(keys.begin(), keys.end());
+    for (const auto& key : keys) {
+        std::cout << key << " ";
+    }
+    std::cout << std::endl;
   }
   
   void EvictItems() {
-    // TODO(interviewee): implement this
+    // 1. Evict expired items, earliest expiry first
+    while (!heapOfExpiration.empty() && entries[heapOfExpiration.top()].expireTime < g_Time) {
+        Remove(heapOfExpiration.top());
+    }
+
+    // 2. Evict lowest priority, least recently used
+    while (values.size() > static_cast<size_t>(std::max(maxItems, 0))) {
+        uint32_t slot = heapOfPriority.top();
+        Entry& entry = entries[slot];
+        if (entry.heapTimeUsed != entry.lastTimeUsed) {
+            // Used since it was placed: move it to where it really belongs
+            entry.heapTimeUsed = entry.lastTimeUsed;
+            heapOfPriority.update(slot);
+            continue;
+        }
+        Remove(slot);
+    }
+  }
+
+private:
+  uint32_t AllocateSlot() {
+    if (!freeSlots.empty()) {
+        uint32_t slot = freeSlots.back();
+        freeSlots.pop_back();
+        return slot;
+    }
+    entries.emplace_back();
+    return static_cast<uint32_t>(entries.size() - 1);
+  }
+
+  void Remove(uint32_t slot) {
+    heapOfPriority.erase(slot);
+    heapOfExpiration.erase(slot);
+    values.erase(entries[slot].dataKey);
+    freeSlots.push_back(slot);
   }
 };
 
@@ -173,4 +331,4 @@ int main() {
 // pq还是红黑树
 // linkedlist，全局还是不全局。
 // 用c++现成的库
-
+// 4 叉 indexed heap，entry 放在连续数组里，heap 里只存下标；Get 只更新 lastTimeUsed，evict 时再把过时的堆顶下沉。